@@ -0,0 +1,126 @@
+extern "C" {
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "postmaster/autovacuum.h"
+#include "replication/walsender.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/procarray.h"
+#include "storage/shmem.h"
+
+}
+
+#include "arm.h"
+
+namespace {
+
+struct ArmShared
+{
+    int     slots;
+    ArmSlot slot[FLEXIBLE_ARRAY_MEMBER]; // By PGPROC number
+};
+
+}
+
+static ArmSlot    unarmed; // Never armed
+static ArmShared *shared = nullptr;
+static int        slots = 0;
+
+ArmSlot *my_arm_slot = &unarmed;
+
+// Regular backends and background workers, akin to MaxBackends which
+// isn't computed yet while preloading. Auxiliary processes and
+// prepared transactions come after those, they don't plan.
+static int regular_backends()
+{
+    int n = MaxConnections + autovacuum_max_workers + 1 + max_worker_processes;
+#if PG_VERSION_NUM >= 120000
+    n += max_wal_senders;
+#endif
+    return n;
+}
+
+static Size arm_shmem_size()
+{
+    return add_size(offsetof(ArmShared, slot),
+                    mul_size(slots, sizeof(ArmSlot)));
+}
+
+void arm_request()
+{
+    slots = regular_backends();
+    RequestAddinShmemSpace(arm_shmem_size());
+}
+
+void arm_startup()
+{
+    bool found;
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    shared = static_cast<ArmShared *>(
+        ShmemInitStruct("planscape arm", arm_shmem_size(), &found));
+
+    if (!found) {
+        shared->slots = slots;
+        for (int i = 0; i < slots; i++) {
+            pg_atomic_init_u32(&shared->slot[i].armed, 0);
+            shared->slot[i].pid = 0;
+        }
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+bool arm_available()
+{
+    return shared != nullptr;
+}
+
+void arm_attach()
+{
+    if (shared && MyProc && MyProc->pgprocno < shared->slots)
+        my_arm_slot = &shared->slot[MyProc->pgprocno];
+}
+
+bool arm_backend(int pid, uint32 count)
+{
+    PGPROC *proc = BackendPidGetProc(pid);
+
+    if (!proc || proc->pgprocno >= shared->slots)
+        return false;
+
+    ArmSlot &slot = shared->slot[proc->pgprocno];
+
+    slot.pid = pid;
+    pg_write_barrier();
+    pg_atomic_write_u32(&slot.armed, count);
+
+    // Nothing to interrupt, the next planner invocation notices.
+    // Wake the backend up in case it waits for something.
+    SetLatch(&proc->procLatch);
+
+    return true;
+}
+
+bool arm_consume()
+{
+    ArmSlot &slot = *my_arm_slot;
+    uint32 armed = pg_atomic_read_u32(&slot.armed);
+
+    pg_read_barrier();
+
+    if (slot.pid != MyProcPid) {
+        pg_atomic_compare_exchange_u32(&slot.armed, &armed, 0);
+        return false;
+    }
+
+    while (armed != 0) {
+        if (pg_atomic_compare_exchange_u32(&slot.armed, &armed, armed - 1))
+            return true;
+    }
+
+    return false;
+}
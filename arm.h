@@ -0,0 +1,48 @@
+#pragma once
+
+extern "C" {
+#include "postgres.h"
+#include "port/atomics.h"
+}
+
+// Remote arm: a backend can be asked to capture its next planner
+// invocations. Each backend has a slot in shared memory holding the
+// number of captures pending; the planner hook polls it. Available
+// when planscape is preloaded.
+
+struct ArmSlot
+{
+    pg_atomic_uint32 armed; // Captures pending
+    int              pid; // Backend armed
+};
+
+// The backend's slot, a dummy one until arm_attach().
+extern ArmSlot *my_arm_slot;
+
+// Request shared memory, call from _PG_init() while preloading.
+void arm_request();
+
+// Attach to shared memory, shmem_startup_hook.
+void arm_startup();
+
+bool arm_available();
+
+// Point my_arm_slot at the backend's slot.
+void arm_attach();
+
+// Arm @count captures in the backend with @pid.
+//
+// Returns: false if there's no such backend
+bool arm_backend(int pid, uint32 count);
+
+// Take a pending capture.
+//
+// Returns: false if none (or the arm was meant for a former occupant
+// of the slot)
+bool arm_consume();
+
+// Cheap enough for every planner invocation: a relaxed atomic load.
+inline bool arm_pending()
+{
+    return pg_atomic_read_u32(&my_arm_slot->armed) != 0;
+}
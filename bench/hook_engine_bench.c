@@ -0,0 +1,124 @@
+// What a hooked pfree() costs when nothing is captured: a palloc()-like
+// free-list allocator, hooked the way pg_hooks.cpp hooks pfree(), timed
+// before the hook is installed, installed with an idle wrapper and
+// installed but disabled.
+//
+//   make hook_engine_bench && ./hook_engine_bench
+
+#include "hook_engine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LOOPS   100000000
+#define BATCH   16
+#define CLASSES 5
+#define ROUNDS  5
+
+typedef struct Chunk
+{
+    struct Chunk *next;
+    int           class;
+} Chunk;
+
+static Chunk *freelist[CLASSES];
+
+__attribute__((noinline)) void *bench_palloc(size_t size)
+{
+    int class = 0;
+
+    while ((16u << class) < size)
+        class++;
+
+    Chunk *chunk = freelist[class];
+    if (chunk)
+        freelist[class] = chunk->next;
+    else {
+        chunk = malloc(sizeof(Chunk) + (16u << class));
+        chunk->class = class;
+    }
+    return chunk + 1;
+}
+
+__attribute__((noinline)) void bench_pfree(void *pointer)
+{
+    Chunk *chunk = (Chunk *) pointer - 1;
+
+    chunk->next = freelist[chunk->class];
+    freelist[chunk->class] = chunk;
+}
+
+// As __wrap__pfree(): a capture in progress would be checked here.
+static void *volatile ic;
+
+void __real__bench_pfree(void *pointer);
+HOOK_DEFINE_TRAMPOLINE(__real__bench_pfree);
+
+static void __wrap__bench_pfree(void *pointer)
+{
+    if (ic && ic == pointer)
+        return;
+
+    __real__bench_pfree(pointer);
+}
+
+static uint64_t timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ns per palloc()/pfree() pair, the best of ROUNDS.
+static double measure(void)
+{
+    void *chunks[BATCH];
+    double best = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        const uint64_t begin = timestamp();
+
+        for (int i = 0; i < LOOPS; i += BATCH) {
+            for (int j = 0; j < BATCH; j++)
+                chunks[j] = bench_palloc(16 << (j % CLASSES));
+            for (int j = 0; j < BATCH; j++)
+                bench_pfree(chunks[j]);
+        }
+
+        const double ns = (double) (timestamp() - begin) / LOOPS;
+        if (round == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+static void check(int rc)
+{
+    if (rc != 0) {
+        fprintf(stderr, "%s\n", hook_last_error());
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(void)
+{
+    const double uninstalled = measure();
+
+    check(hook_install(bench_pfree, __wrap__bench_pfree, __real__bench_pfree));
+    const double enabled = measure();
+
+    check(hook_disable(bench_pfree));
+    const double disabled = measure();
+
+    check(hook_uninstall(bench_pfree));
+
+    printf("%-26s %6.2f ns/pair\n", "uninstalled", uninstalled);
+    printf("%-26s %6.2f ns/pair (%+.1f%%)\n", "installed, idle wrapper",
+           enabled, (enabled / uninstalled - 1) * 100);
+    printf("%-26s %6.2f ns/pair (%+.1f%%)\n", "installed, disabled",
+           disabled, (disabled / uninstalled - 1) * 100);
+    return 0;
+}
@@ -0,0 +1,30 @@
+-- palloc()/pfree() cost with planscape's hooks not installed, then
+-- installed but disabled after a capture. Needs the palloc_bench
+-- module (make -C bench install) and a superuser; run in a fresh
+-- session:
+--
+--   psql -X -f bench/palloc.sql
+--
+-- With planscape in shared_preload_libraries, hooks are installed and
+-- enabled from the start: both rows then measure idle wrappers.
+
+\set loops 10000000
+
+CREATE EXTENSION IF NOT EXISTS planscape;
+LOAD 'planscape';
+
+CREATE FUNCTION pg_temp.palloc_bench(loops int)
+RETURNS float8
+AS 'palloc_bench'
+LANGUAGE C STRICT VOLATILE;
+
+SELECT 'before capture' AS hooks,
+       min(pg_temp.palloc_bench(:loops)) AS ns_per_pair
+  FROM generate_series(1, 5);
+
+-- Patches the backend, hooks stay disabled afterwards.
+EXPLAIN (PLANSCAPE) SELECT 1;
+
+SELECT 'after capture' AS hooks,
+       min(pg_temp.palloc_bench(:loops)) AS ns_per_pair
+  FROM generate_series(1, 5);
@@ -0,0 +1,49 @@
+/*
+ * palloc()/pfree() timing for bench/palloc.sql, a module of its own so
+ * that the planscape extension doesn't ship it.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+
+#include <time.h>
+
+PG_MODULE_MAGIC;
+
+PG_FUNCTION_INFO_V1(palloc_bench);
+
+#define BATCH 16
+
+/* palloc()/pfree() pairs of assorted sizes, @loops of them, ns per pair. */
+Datum
+palloc_bench(PG_FUNCTION_ARGS)
+{
+    int32       loops = PG_GETARG_INT32(0);
+    void       *chunks[BATCH];
+    struct timespec begin, end;
+    int         pairs = 0;
+
+    if (loops <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("loop count must be positive")));
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    while (pairs < loops)
+    {
+        int         j;
+
+        for (j = 0; j < BATCH; j++)
+            chunks[j] = palloc(16 << (j % 5));
+        for (j = 0; j < BATCH; j++)
+            pfree(chunks[j]);
+
+        pairs += BATCH;
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    PG_RETURN_FLOAT8(((end.tv_sec - begin.tv_sec) * 1e9
+                      + (end.tv_nsec - begin.tv_nsec)) / pairs);
+}
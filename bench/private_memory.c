@@ -0,0 +1,168 @@
+// What patching code costs each backend, outside PostgreSQL: a parent
+// standing in for the postmaster forks children standing in for
+// backends, HOOKS functions on pages of their own are hooked the way
+// pg_hooks.cpp hooks the planner, and the children's Private_Dirty is
+// read from /proc/<pid>/smaps_rollup. Hooks are either not installed,
+// installed by every child after fork() or installed by the parent
+// before it.
+//
+//   make private_memory && ./private_memory [children]
+//
+// bench/private_memory.sh measures PostgreSQL itself.
+
+#include "hook_engine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// About as many as planscape installs.
+#define HOOKS 48
+
+// A function per page, as hooked functions are spread over the
+// executable.
+#define TARGET(n) \
+    __attribute__((noinline, aligned(4096))) \
+    int target_##n(int a) { return a * (n + 3) + 1; }
+
+#define TARGETS8(n) \
+    TARGET(n##0) TARGET(n##1) TARGET(n##2) TARGET(n##3) \
+    TARGET(n##4) TARGET(n##5) TARGET(n##6) TARGET(n##7)
+
+TARGETS8(1) TARGETS8(2) TARGETS8(3) TARGETS8(4) TARGETS8(5) TARGETS8(6)
+
+#define REF8(n) \
+    target_##n##0, target_##n##1, target_##n##2, target_##n##3, \
+    target_##n##4, target_##n##5, target_##n##6, target_##n##7,
+
+static int (*const targets[HOOKS])(int) = {
+    REF8(1) REF8(2) REF8(3) REF8(4) REF8(5) REF8(6)
+};
+
+static void *trampolines[HOOKS];
+
+static int replacement(int a)
+{
+    return a;
+}
+
+static void install_hooks(void)
+{
+    int rc = hook_begin();
+
+    for (int i = 0; i < HOOKS && rc == 0; i++)
+        rc = hook_install_alloc((void *)targets[i], (void *)replacement,
+                                &trampolines[i]);
+
+    if (rc != 0 || hook_end() != 0) {
+        fprintf(stderr, "%s\n", hook_last_error());
+        exit(EXIT_FAILURE);
+    }
+}
+
+static long private_dirty(pid_t pid)
+{
+    char path[64], line[256];
+    long kb = -1;
+
+    snprintf(path, sizeof path, "/proc/%d/smaps_rollup", (int)pid);
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof line, f))
+        if (sscanf(line, "Private_Dirty: %ld kB", &kb) == 1)
+            break;
+
+    fclose(f);
+    return kb;
+}
+
+enum Mode { NONE, CHILD, PARENT };
+
+// Average Private_Dirty of @children, kB.
+static double measure(enum Mode mode, int children)
+{
+    pid_t *pids = calloc(children, sizeof(pid_t));
+    int ready[2];
+    long total = 0;
+    char c;
+
+    if (pipe(ready) != 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mode == PARENT)
+        install_hooks();
+
+    for (int i = 0; i < children; i++) {
+        pids[i] = fork();
+
+        if (pids[i] < 0) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+
+        if (pids[i] == 0) {
+            if (mode == CHILD)
+                install_hooks();
+
+            // Whatever the backend does, hooked or not.
+            int sum = 0;
+            for (int j = 0; j < HOOKS; j++)
+                sum += mode == NONE ? targets[j](j)
+                                    : ((int (*)(int))trampolines[j])(j);
+
+            if (write(ready[1], &c, 1) != 1)
+                _exit(EXIT_FAILURE);
+            pause();
+            _exit(sum == 0);
+        }
+    }
+
+    for (int i = 0; i < children; i++)
+        if (read(ready[0], &c, 1) != 1) {
+            perror("read");
+            exit(EXIT_FAILURE);
+        }
+
+    for (int i = 0; i < children; i++)
+        total += private_dirty(pids[i]);
+
+    for (int i = 0; i < children; i++) {
+        kill(pids[i], SIGKILL);
+        waitpid(pids[i], NULL, 0);
+    }
+
+    close(ready[0]);
+    close(ready[1]);
+    free(pids);
+
+    return (double)total / children;
+}
+
+int main(int argc, char **argv)
+{
+    const int children = argc > 1 ? atoi(argv[1]) : 500;
+    static const char *const names[] = {
+        "not hooked", "hooked in each child", "hooked in the parent",
+    };
+    double kb[3];
+
+    // The parent's hooks stay, measure it last.
+    for (int mode = NONE; mode <= PARENT; mode++)
+        kb[mode] = measure(mode, children);
+
+    printf("%d children, %d hooks, Private_Dirty per child:\n",
+           children, HOOKS);
+    for (int mode = NONE; mode <= PARENT; mode++)
+        printf("  %-22s %7.1f kB (%+.1f kB)\n", names[mode], kb[mode],
+               kb[mode] - kb[NONE]);
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Private_Dirty per backend with 500 connections: planscape not loaded,
+# loaded per session (every backend patches its own code on the first
+# EXPLAIN (PLANSCAPE)) and preloaded (patched once in the postmaster).
+#
+#   PATH=/usr/local/pgsql/bin:$PATH bench/private_memory.sh [connections]
+#
+# Needs initdb, pg_ctl and psql of a server planscape is installed
+# into, and /proc/<pid>/smaps_rollup (Linux 4.14+). Runs throwaway
+# clusters in a temporary directory, as the current user.
+
+set -e
+
+CONNECTIONS=${1:-500}
+PORT=${PGPORT:-54329}
+DIR=$(mktemp -d)
+trap 'pg_ctl -D "$DIR/data" -m immediate stop >/dev/null 2>&1 || true; rm -rf "$DIR"' EXIT
+
+export PGHOST="$DIR" PGPORT="$PORT" PGDATABASE=postgres
+
+initdb -D "$DIR/data" -A trust >/dev/null
+
+# Sum Private_Dirty (kB) of the client backends
+private_dirty() {
+    for pid in $(psql -XAtc "SELECT pid FROM pg_stat_activity
+                             WHERE backend_type = 'client backend'
+                               AND pid <> pg_backend_pid()"); do
+        awk '/^Private_Dirty:/ { print $2 }' "/proc/$pid/smaps_rollup"
+    done | awk '{ kb += $1; n++ }
+                END { printf "%d backends, %.0f kB total, %.1f kB per backend\n",
+                             n, kb, kb / n }'
+}
+
+measure() {
+    mode=$1 preload=$2 setup=$3
+
+    pg_ctl -D "$DIR/data" -l "$DIR/log" -w \
+        -o "-p $PORT -k $DIR -c max_connections=$((CONNECTIONS + 10))
+            -c shared_preload_libraries='$preload'" start >/dev/null
+
+    psql -Xqc "CREATE EXTENSION IF NOT EXISTS planscape"
+
+    i=0
+    while [ $i -lt "$CONNECTIONS" ]; do
+        psql -Xq >/dev/null 2>&1 <<SQL &
+$setup
+SELECT pg_sleep(3600);
+SQL
+        i=$((i + 1))
+    done
+
+    # All sessions done with $setup
+    while [ "$(psql -XAtc "SELECT count(*) FROM pg_stat_activity
+                           WHERE query LIKE 'SELECT pg_sleep%'
+                             AND state = 'active'")" -lt "$CONNECTIONS" ]; do
+        sleep 1
+    done
+
+    printf '%-12s ' "$mode"
+    private_dirty
+
+    pg_ctl -D "$DIR/data" -m immediate stop >/dev/null
+    wait
+}
+
+CAPTURE="LOAD 'planscape'; EXPLAIN (PLANSCAPE) SELECT 1;"
+
+measure "not loaded" ""          ""
+measure "session"    ""          "$CAPTURE"
+measure "preloaded"  "planscape" "$CAPTURE"
@@ -0,0 +1,119 @@
+extern "C" {
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "nodes/relation.h"
+#include "nodes/plannodes.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/planmain.h"
+#include "optimizer/planner.h"
+#include "optimizer/paths.h"
+#include "optimizer/geqo.h"
+#include "optimizer/geqo_pool.h"
+#include "optimizer/cost.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
+#include "utils/catcache.h"
+#include "utils/relcache.h"
+#include "access/genam.h"
+#include "storage/lock.h"
+#include "optimizer/plancat.h"
+#if PG_VERSION_NUM >= 110000
+#include "partitioning/partprune.h"
+#endif
+#include "commands/explain.h"
+
+}
+
+#include "events.h"
+#include "pg_hooks.h"
+#include "hook_engine.h"
+
+EventSubscriber event_subscribers[PLANSCAPE_EVENT_COUNT][PLANSCAPE_SUBSCRIBERS_MAX];
+int             event_subscriber_count[PLANSCAPE_EVENT_COUNT];
+
+// Functions hooked to intercept @event.
+static std::vector<void *> event_hooks(PlanscapeEvent event)
+{
+    switch (event) {
+    case PLANSCAPE_EVENT_ADD_PATH:
+        return {reinterpret_cast<void *>(add_path)};
+    case PLANSCAPE_EVENT_ADD_PARTIAL_PATH:
+        return {reinterpret_cast<void *>(add_partial_path)};
+    case PLANSCAPE_EVENT_CREATE_PLAN:
+        return {reinterpret_cast<void *>(create_plan)};
+    default:
+        return {};
+    }
+}
+
+static const char *events_error = "";
+
+static int subscribe(PlanscapeEvent event, PlanscapeCallback callback,
+                     void *arg)
+{
+    if (event < 0 || event >= PLANSCAPE_EVENT_COUNT || !callback) {
+        events_error = "invalid event or callback";
+        return -1;
+    }
+
+    int &count = event_subscriber_count[event];
+
+    if (count == PLANSCAPE_SUBSCRIBERS_MAX) {
+        events_error = "too many subscribers";
+        return -1;
+    }
+
+    // Every subscription enables the event's hooks, captures enable
+    // the rest.
+    if (!(install_hooks() && enable_hooks(event_hooks(event)))) {
+        events_error = hook_last_error();
+        return -1;
+    }
+
+    event_subscribers[event][count++] = EventSubscriber{callback, arg};
+    return 0;
+}
+
+static void unsubscribe(PlanscapeEvent event, PlanscapeCallback callback,
+                        void *arg)
+{
+    if (event < 0 || event >= PLANSCAPE_EVENT_COUNT)
+        return;
+
+    EventSubscriber *subscribers = event_subscribers[event];
+    int &count = event_subscriber_count[event];
+
+    for (int i = 0; i < count; i++) {
+        if (subscribers[i].callback != callback || subscribers[i].arg != arg)
+            continue;
+
+        // Keep the array dense, dispatch order is subscription order.
+        for (int j = i + 1; j < count; j++)
+            subscribers[j - 1] = subscribers[j];
+        count--;
+
+        disable_hooks(event_hooks(event));
+        return;
+    }
+}
+
+static const char *last_error()
+{
+    return events_error;
+}
+
+static const PlanscapeEventsApi api = {
+    PLANSCAPE_EVENTS_API_VERSION,
+    subscribe,
+    unsubscribe,
+    last_error
+};
+
+void events_init()
+{
+    auto **slot = reinterpret_cast<const PlanscapeEventsApi **>(
+        find_rendezvous_variable(PLANSCAPE_EVENTS_RENDEZVOUS));
+    *slot = &api;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "planscape_events.h"
+
+struct EventSubscriber
+{
+    PlanscapeCallback callback;
+    void             *arg;
+};
+
+extern EventSubscriber event_subscribers[PLANSCAPE_EVENT_COUNT][PLANSCAPE_SUBSCRIBERS_MAX];
+extern int             event_subscriber_count[PLANSCAPE_EVENT_COUNT];
+
+// Publish the API via the rendezvous variable.
+void events_init();
+
+// Invoke subscribers of @event, if any.
+inline void dispatch_event(PlanscapeEvent event, PlannerInfo *root,
+                           RelOptInfo *rel, Path *path, Plan *plan)
+{
+    const int count = event_subscriber_count[event];
+
+    if (!count) return;
+
+    const PlanscapeEventData data = {event, root, rel, path, plan};
+    const EventSubscriber *subscribers = event_subscribers[event];
+
+    for (int i = 0; i < count; i++)
+        subscribers[i].callback(&data, subscribers[i].arg);
+}
@@ -14,20 +14,118 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <assert.h>
 #include <dlfcn.h>
 
+// Dynamic trampolines are carved from executable pages mapped near
+// hooked functions, HOOK_SLOT_LEN bytes each: code, then jump table.
+#define HOOK_SLOT_LEN         128
+#define HOOK_SLOT_CODE_LEN    72
+#define HOOK_POOL_PAGES       64
+#define HOOK_POOL_SLOTS_MAX   64
+
+_Static_assert(HOOK_CODE_MAX <= HOOK_SLOT_LEN, "HOOK_CODE_MAX too big");
+
 struct Overlay
 {
     uintptr_t target; // Where in address space this will ultimately end up.
     uint8_t  *p;      // Current output position.
-    uint8_t   code[HOOK_TRAMPOLINE_LEN];
+    uint8_t   code[HOOK_SLOT_LEN];
+};
+
+// Jump table a trampoline's jumps go through.
+struct JumpTable
+{
+    uintptr_t target; // Where in address space the next entry is.
+    uint64_t *p;      // Where the next entry is written.
+};
+
+// Max distance between a function and its dynamic trampoline, leaving
+// room for a rel32 jump's displacement to be computed from either end.
+#define HOOK_NEAR_RANGE       (((uintptr_t)1 << 31) - ((uintptr_t)1 << 20))
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE   0x100000
+#endif
+
+struct TrampolinePage
+{
+    uintptr_t base;
+    uint64_t  used;   // Slots bitmap
 };
 
+static struct TrampolinePage g_pages[HOOK_POOL_PAGES];
+static size_t                g_pages_count;
+
+// Installed hook, see hook_uninstall(), hook_enable().
+struct Hook
+{
+    uintptr_t fn;
+    uintptr_t trampoline;
+    size_t    len;        // Bytes clobbered in @fn
+    uintptr_t relay;      // Pool slot jumping to replacement, if any
+    int       enabled;
+    int       dynamic;    // Trampoline from the pool
+    uint8_t   original[HOOK_CLOBBERED_LEN];
+    uint8_t   patched[HOOK_CLOBBERED_LEN];
+};
+
+static struct Hook g_hooks[HOOK_MAX];
+static size_t      g_hooks_count;
+
 static __thread int g_mem_fd = -1;
-static __thread char g_errmsg[256];
+static __thread char g_errmsg[1024];
+
+// Code writes queued by a transaction, see hook_begin(). Applied in
+// order at commit, coalesced per page.
+#define HOOK_WRITES_MAX       (HOOK_MAX * 4)
 
-#define FORMAT_ERRMSG(...) snprintf(g_errmsg, sizeof g_errmsg, __VA_ARGS__)
+struct Write
+{
+    uintptr_t target;
+    size_t    len;
+    uint8_t   code[HOOK_SLOT_LEN];
+};
+
+struct Transaction
+{
+    int                    active;
+    int                    errors;
+    size_t                 writes_count;
+    struct Write           writes[HOOK_WRITES_MAX];
+
+    // Registry state to roll back to.
+    struct Hook            hooks[HOOK_MAX];
+    size_t                 hooks_count;
+    uint64_t               pages_used[HOOK_POOL_PAGES];
+    size_t                 pages_count;
+};
+
+static struct Transaction g_txn;
+
+// Errors within a transaction accumulate, one per failed operation.
+static
+void format_errmsg(const char *fmt, ...)
+{
+    size_t off = 0;
+    va_list ap;
+
+    if (g_txn.active && g_txn.errors++) {
+        off = strlen(g_errmsg);
+        if (off + 2 < sizeof g_errmsg) {
+            strcpy(g_errmsg + off, "; ");
+            off += 2;
+        }
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(g_errmsg + off, sizeof g_errmsg - off, fmt, ap);
+    va_end(ap);
+}
+
+#define FORMAT_ERRMSG(...) format_errmsg(__VA_ARGS__)
 
 // Dump as many bytes as fit into buf, but don't cross page boundary.
 static
@@ -78,35 +176,114 @@ size_t overlay_size(const struct Overlay *c)
 }
 
 static
-int install_overlay(const struct Overlay *c)
+int write_code(uintptr_t target, const uint8_t *code, size_t len)
 {
-    ssize_t c_size = overlay_size(c);
+    // Outside of a transaction: open /proc/self/mem for this write
+    // alone, a descriptor kept open would patch the parent after
+    // fork().
+    const int standalone = g_mem_fd == -1;
 
-    if (g_mem_fd == -1) {
-        // No /proc/self/mem available, use mprotect.
+    if (standalone)
+        g_mem_fd = open("/proc/self/mem", O_WRONLY);
 
-        uintptr_t page_mask  = sysconf(_SC_PAGESIZE) - 1;
-        uintptr_t page_begin = c->target & ~page_mask;
-        uintptr_t page_end   = (c->target + c_size + page_mask) & ~page_mask;
+    if (g_mem_fd != -1) {
+        const ssize_t written = pwrite(g_mem_fd, code, len, target);
+        const int saved_errno = errno;
 
-        if (mprotect((void*)page_begin, page_end - page_begin, PROT_WRITE|PROT_EXEC) != 0)
-            goto error;
+        if (standalone) {
+            close(g_mem_fd);
+            g_mem_fd = -1;
+        }
 
-        memcpy((void*)c->target, c->code, c_size);
+        if (written == (ssize_t)len)
+            return 0;
 
-        mprotect((void*)page_begin, page_end - page_begin, PROT_EXEC);
-        return 0;
+        errno = saved_errno;
+        goto error;
     }
 
-    if (pwrite(g_mem_fd, c->code, c_size, c->target) == c_size) {
-        return 0;
-    }
+    // No /proc/self/mem available, use mprotect. The pages are never
+    // writable and executable at once: the code on them can't run
+    // meanwhile, hence a byte loop rather than memcpy(), which could
+    // live on one of them.
+    uintptr_t page_mask  = sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t page_begin = target & ~page_mask;
+    uintptr_t page_end   = (target + len + page_mask) & ~page_mask;
+
+    if (mprotect((void*)page_begin, page_end - page_begin, PROT_READ|PROT_WRITE) != 0)
+        goto error;
+
+    for (size_t i = 0; i < len; i++)
+        ((volatile uint8_t *)target)[i] = code[i];
+
+    mprotect((void*)page_begin, page_end - page_begin, PROT_READ|PROT_EXEC);
+    return 0;
 
 error:
     FORMAT_ERRMSG("patching code in memory: %s", strerror(errno));
     return -1;
 }
 
+static
+int install_overlay(const struct Overlay *c)
+{
+    size_t c_size = overlay_size(c);
+
+    if (!g_txn.active)
+        return write_code(c->target, c->code, c_size);
+
+    if (g_txn.writes_count == HOOK_WRITES_MAX) {
+        FORMAT_ERRMSG("too many code writes in a transaction");
+        return -1;
+    }
+
+    struct Write *w = &g_txn.writes[g_txn.writes_count++];
+
+    assert(c_size <= sizeof w->code);
+    w->target = c->target;
+    w->len    = c_size;
+    memcpy(w->code, c->code, c_size);
+
+    return 0;
+}
+
+// Code at [@begin, @end) was queued for patching in this transaction.
+// Reading it would yield stale bytes.
+static
+int pending_write(uintptr_t begin, uintptr_t end)
+{
+    for (size_t i = 0; i < g_txn.writes_count; i++) {
+        const struct Write *w = &g_txn.writes[i];
+
+        if (w->target < end && w->target + w->len > begin)
+            return 1;
+    }
+
+    return 0;
+}
+
+static
+int install_bytes(uintptr_t target, const uint8_t *bytes, size_t len)
+{
+    struct Overlay c = {.target = target, .p = c.code};
+
+    assert(len <= sizeof c.code);
+    memcpy(c.p, bytes, len);
+    c.p += len;
+
+    return install_overlay(&c);
+}
+
+static
+struct Hook *find_hook(void *fn)
+{
+    for (size_t i = 0; i < g_hooks_count; i++) {
+        if (g_hooks[i].fn == (uintptr_t)fn)
+            return &g_hooks[i];
+    }
+    return NULL;
+}
+
 static
 void write_initial_jmp(struct Overlay *c, uintptr_t target)
 {
@@ -123,20 +300,49 @@ void write_initial_jmp(struct Overlay *c, uintptr_t target)
 }
 
 static
-void write_jmp(struct Overlay *c, uintptr_t target, uintptr_t **jump_table)
+int is_rel32(uintptr_t target, uintptr_t rip)
+{
+    const int64_t delta = (int64_t)(target - rip);
+    return delta == (int32_t)delta;
+}
+
+static
+void write_rel32_jmp(struct Overlay *c, uintptr_t target)
+{
+    // jmp rel32
+    c->p[0] = 0xE9;
+    put_uint32(c->p + 1, target - (c->target + overlay_size(c) + 5));
+
+    c->p += 5;
+}
+
+static
+void write_abs_jmp(struct Overlay *c, uintptr_t target)
+{
+    // jmp *0(%rip), followed by the address
+    c->p[0] = 0xFF;
+    c->p[1] = 0x25;
+    put_uint32(c->p + 2, 0);
+    put_uint64(c->p + 6, target);
+
+    c->p += 14;
+}
+
+static
+void write_jmp(struct Overlay *c, uintptr_t target, struct JumpTable *jump_table)
 {
     // jmp  *jump_table(%rip)
     c->p[0] = 0xff;
     c->p[1] = 0x25;
-    put_uint32(c->p + 2, (uintptr_t)(*jump_table) - (c->target + overlay_size(c) + 6));
+    put_uint32(c->p + 2, jump_table->target - (c->target + overlay_size(c) + 6));
 
     c->p += 6;
-    (*jump_table)[0] = target;
-    (*jump_table)++;
+    *jump_table->p++ = target;
+    jump_table->target += 8;
 }
 
 static
-void write_call(struct Overlay *c, uintptr_t target, uintptr_t **jump_table)
+void write_call(struct Overlay *c, uintptr_t target, struct JumpTable *jump_table)
 {
     // call *jump_table(%rip)
     write_jmp(c, target, jump_table);
@@ -165,29 +371,170 @@ uint64_t *get_jump_table(void *trampoline)
     return ((uint64_t*(*)(void)) ((uintptr_t)trampoline + HOOK_TRAMPOLINE_LEN)) ();
 }
 
-// Patch function @fn, so that every time it is called, control is
-// transferred to @replacement.
-//
-// If @trampoline is provided, instructions destroyed in @fn are
-// transferred to @trampoline.
-int hook_install(void *fn, void *replacement, void *trampoline)
+static
+int is_near(uintptr_t a, uintptr_t b)
+{
+    return (a > b ? a - b : b - a) < HOOK_NEAR_RANGE;
+}
+
+// Map an executable page within HOOK_NEAR_RANGE of @addr, probing
+// free address space on both sides.
+static
+uintptr_t map_near(uintptr_t addr, size_t page_size)
+{
+    const uintptr_t step = (uintptr_t)1 << 16;
+    const uintptr_t base = addr & ~(step - 1);
+
+    for (uintptr_t delta = step; delta < HOOK_NEAR_RANGE; delta += step) {
+
+        const uintptr_t hints[] = {base - delta, base + delta};
+
+        for (size_t i = 0; i < 2; i++) {
+
+            if (hints[i] < step || !is_near(hints[i], addr))
+                continue;
+
+            void *p = mmap((void *)hints[i], page_size, PROT_READ|PROT_EXEC,
+                           MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE,
+                           -1, 0);
+
+            if (p == MAP_FAILED)
+                continue;
+
+            // Kernels predating MAP_FIXED_NOREPLACE treat it as a hint.
+            if ((uintptr_t)p != hints[i]) {
+                munmap(p, page_size);
+                continue;
+            }
+
+            return (uintptr_t)p;
+        }
+    }
+
+    return 0;
+}
+
+static
+size_t pool_slots_per_page(void)
+{
+    size_t slots = sysconf(_SC_PAGESIZE) / HOOK_SLOT_LEN;
+
+    return slots > HOOK_POOL_SLOTS_MAX ? HOOK_POOL_SLOTS_MAX : slots;
+}
+
+static
+void *trampoline_alloc(void *fn)
+{
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t slots = pool_slots_per_page();
+    const uint64_t full = slots == 64 ? UINT64_MAX : ((uint64_t)1 << slots) - 1;
+    struct TrampolinePage *page = NULL;
+
+    for (size_t i = 0; i < g_pages_count && !page; i++) {
+        if (g_pages[i].used != full && is_near(g_pages[i].base, (uintptr_t)fn))
+            page = &g_pages[i];
+    }
+
+    if (!page) {
+
+        if (g_pages_count == HOOK_POOL_PAGES) {
+            FORMAT_ERRMSG("trampoline pool exhausted");
+            return NULL;
+        }
+
+        uintptr_t base = map_near((uintptr_t)fn, page_size);
+        if (!base) {
+            FORMAT_ERRMSG("no free address space near %s for a trampoline",
+                          funcname(fn));
+            return NULL;
+        }
+
+        page = &g_pages[g_pages_count++];
+        page->base = base;
+        page->used = 0;
+    }
+
+    size_t slot = __builtin_ctzll(~page->used);
+    page->used |= (uint64_t)1 << slot;
+
+    return (void *)(page->base + slot * HOOK_SLOT_LEN);
+}
+
+static
+void trampoline_free(void *trampoline)
+{
+    for (size_t i = 0; i < g_pages_count; i++) {
+
+        const uintptr_t offset = (uintptr_t)trampoline - g_pages[i].base;
+
+        if (offset < pool_slots_per_page() * HOOK_SLOT_LEN) {
+            g_pages[i].used &= ~((uint64_t)1 << (offset / HOOK_SLOT_LEN));
+            return;
+        }
+    }
+}
+
+static
+int do_hook_install(void *fn, void *replacement, void *trampoline,
+                    int dynamic)
 {
     // We render code in two overlays, and later overwrite @fn and
     // @trampoline with the overlays' content.
-    struct Overlay fn_overlay = {(uintptr_t)fn, fn_overlay.code};
-    struct Overlay t_overlay  = {(uintptr_t)trampoline, t_overlay.code};
+    struct Overlay fn_overlay = {.target = (uintptr_t)fn, .p = fn_overlay.code};
+    struct Overlay t_overlay  = {.target = (uintptr_t)trampoline,
+                                 .p = t_overlay.code};
 
     // Jump table is normally extracted from the trampoline. Provide a
-    // placeholder if trampoline is NULL
-    uint64_t jump_table_data[HOOK_JUMP_MAX], *jump_table = jump_table_data;
+    // placeholder if trampoline is NULL. Dynamic trampolines have one
+    // in the slot, written along with the code.
+    uint64_t jump_table_data[HOOK_JUMP_MAX];
+    struct JumpTable jump_table = {(uintptr_t)jump_table_data, jump_table_data};
 
-    if (trampoline && !(jump_table = get_jump_table(trampoline))) {
-        FORMAT_ERRMSG("bad trampoline pointer");
+    if (find_hook(fn)) {
+        FORMAT_ERRMSG("%s is already hooked", funcname(fn));
         return -1;
     }
 
-    // Prepare code to overwrite @fn with. This will be JMP @replacement.
-    write_initial_jmp(&fn_overlay, (uintptr_t)replacement);
+    if (g_hooks_count == HOOK_MAX) {
+        FORMAT_ERRMSG("too many hooks");
+        return -1;
+    }
+
+    if (g_txn.active && !dynamic && trampoline
+        && pending_write((uintptr_t)trampoline,
+                         (uintptr_t)trampoline + HOOK_TRAMPOLINE_LEN)) {
+        FORMAT_ERRMSG("trampoline for %s was patched earlier in this transaction",
+                      funcname(fn));
+        return -1;
+    }
+
+    if (dynamic) {
+        jump_table.target = (uintptr_t)trampoline + HOOK_SLOT_CODE_LEN;
+    } else if (trampoline) {
+        uint64_t *p = get_jump_table(trampoline);
+
+        if (!p) {
+            FORMAT_ERRMSG("bad trampoline pointer");
+            return -1;
+        }
+
+        jump_table.target = (uintptr_t)p;
+        jump_table.p = p;
+    }
+
+    // Prepare code to overwrite @fn with. This will be JMP @replacement:
+    // a 5 byte rel32 jump if within reach, or through a relay stub
+    // allocated near @fn, or an absolute jump as the last resort.
+    struct Overlay r_overlay = {.target = 0, .p = r_overlay.code};
+
+    if (is_rel32((uintptr_t)replacement, (uintptr_t)fn + 5)) {
+        write_rel32_jmp(&fn_overlay, (uintptr_t)replacement);
+    } else if ((r_overlay.target = (uintptr_t)trampoline_alloc(fn))) {
+        write_abs_jmp(&r_overlay, (uintptr_t)replacement);
+        write_rel32_jmp(&fn_overlay, r_overlay.target);
+    } else {
+        write_initial_jmp(&fn_overlay, (uintptr_t)replacement);
+    }
 
     // @fn is going to be partially clobbered. Disassemble and evacuate
     // some instructions.
@@ -206,7 +553,7 @@ int hook_install(void *fn, void *replacement, void *trampoline)
                           funcname(fn),
                           (int)(rip - (uintptr_t)fn),
                           hexdump(fn, hexdump_buf, sizeof hexdump_buf));
-            return -1;
+            goto error;
         }
 
         rip += s.len;
@@ -218,7 +565,7 @@ int hook_install(void *fn, void *replacement, void *trampoline)
                           "looks like a breakpoint set by debugger (%s)",
                           funcname(fn),
                           hexdump(fn, hexdump_buf, sizeof hexdump_buf));
-            return -1;
+            goto error;
 
         case 0xE8:
             // relative call, 32 bit immediate offset
@@ -228,16 +575,16 @@ int hook_install(void *fn, void *replacement, void *trampoline)
             goto check_rip_dest;
 
         case 0xE9:
-            // relative jump, 8 bit immediate offset
-            assert(s.flags & F_IMM8);
-            rip_dest = rip + (int8_t)s.imm.imm8;
+            // relative jump, 32 bit immediate offset
+            assert(s.flags & F_IMM32);
+            rip_dest = rip + (int32_t)s.imm.imm32;
             write_jmp(&t_overlay, rip_dest, &jump_table);
             goto check_rip_dest;
 
         case 0xEB:
-            // relative jump, 32 bit immediate offset
-            assert(s.flags & F_IMM32);
-            rip_dest = rip + (int32_t)s.imm.imm32;
+            // relative jump, 8 bit immediate offset
+            assert(s.flags & F_IMM8);
+            rip_dest = rip + (int8_t)s.imm.imm8;
             write_jmp(&t_overlay, rip_dest, &jump_table);
             goto check_rip_dest;
 
@@ -246,7 +593,7 @@ int hook_install(void *fn, void *replacement, void *trampoline)
             FORMAT_ERRMSG("creating trampoline for %s: 'JCXZ' instruction not supported (%s)",
                           funcname(fn),
                           hexdump(fn, hexdump_buf, sizeof hexdump_buf));
-            return -1;
+            goto error;
 
         case 0x70 ... 0x7f:
             // Jcc jump, 8 bit immediate offset
@@ -281,12 +628,32 @@ int hook_install(void *fn, void *replacement, void *trampoline)
         if ((s.flags & F_MODRM) &&
             s.modrm_mod == 0 && s.modrm_rm == 0x5) {
 
+            const uintptr_t target = rip + (int32_t)s.disp.disp32;
+            const uintptr_t new_rip = t_overlay.target + overlay_size(&t_overlay) + s.len;
+
+            // Within reach from the trampoline? Copy the instruction,
+            // adjusting displacement (followed by immediate if any).
+            if (trampoline && is_rel32(target, new_rip)) {
+
+                const size_t imm_len = (s.flags & F_IMM64) ? 8 :
+                                       (s.flags & F_IMM32) ? 4 :
+                                       (s.flags & F_IMM16) ? 2 :
+                                       (s.flags & F_IMM8)  ? 1 : 0;
+
+                memcpy(t_overlay.p, (const uint8_t *)rip - s.len, s.len);
+                put_uint32(t_overlay.p + s.len - imm_len - 4, target - new_rip);
+                t_overlay.p += s.len;
+
+                continue;
+            }
+
             // LEA?
             if (s.opcode != 0x8D) {
-                FORMAT_ERRMSG("creating trampoline for %s: %%rip-relative addressing (%s)",
+                FORMAT_ERRMSG("creating trampoline for %s: %%rip-relative addressing "
+                              "out of trampoline's reach (%s)",
                               funcname(fn),
                               hexdump(fn, hexdump_buf, sizeof hexdump_buf));
-                return -1;
+                goto error;
             }
 
             // Convert to MOV
@@ -311,10 +678,18 @@ check_rip_dest:
                           "clobbered instruction range encountered (%s)",
                           funcname(fn),
                           hexdump(fn, hexdump_buf, sizeof hexdump_buf));
-            return -1;
+            goto error;
         }
     }
 
+    // Disassembled the code as it is now, not as a pending write would
+    // leave it.
+    if (g_txn.active && pending_write((uintptr_t)fn, rip)) {
+        FORMAT_ERRMSG("%s was patched earlier in this transaction",
+                      funcname(fn));
+        goto error;
+    }
+
     // If we've clobbered a *part* of an instruction, we should beter
     // int3 the surviving part.
     size_t partially_clobbered = rip - rip_hazzard;
@@ -324,28 +699,377 @@ check_rip_dest:
     // Connect trampoline to the unclobbered part of @fn.
     write_jmp(&t_overlay, rip, &jump_table);
 
+    if (overlay_size(&t_overlay) > (dynamic ? HOOK_SLOT_CODE_LEN
+                                            : HOOK_TRAMPOLINE_LEN)) {
+        FORMAT_ERRMSG("creating trampoline for %s: relocated code too long",
+                      funcname(fn));
+        goto error;
+    }
+
+    if (dynamic) {
+        // Code, padding, jump table.
+        const size_t entries = jump_table.p - jump_table_data;
+
+        memset(t_overlay.p, 0xcc, HOOK_SLOT_CODE_LEN - overlay_size(&t_overlay));
+        t_overlay.p = t_overlay.code + HOOK_SLOT_CODE_LEN;
+        memcpy(t_overlay.p, jump_table_data, entries * sizeof(uint64_t));
+        t_overlay.p += entries * sizeof(uint64_t);
+    }
+
+    // Keep both versions of the clobbered bytes for hook_enable() and
+    // friends.
+    struct Hook *hook = &g_hooks[g_hooks_count];
+
+    hook->fn         = (uintptr_t)fn;
+    hook->trampoline = (uintptr_t)trampoline;
+    hook->len        = overlay_size(&fn_overlay);
+    hook->enabled    = 1;
+    hook->dynamic    = dynamic;
+    hook->relay      = r_overlay.target;
+    memcpy(hook->original, fn, hook->len);
+    memcpy(hook->patched, fn_overlay.code, hook->len);
+
     // Now actually owerwrite things.
     if (trampoline && install_overlay(&t_overlay) != 0)
+        goto error;
+
+    if (r_overlay.target && install_overlay(&r_overlay) != 0)
+        goto error;
+
+    if (install_overlay(&fn_overlay) != 0)
+        goto error;
+
+    g_hooks_count++;
+    return 0;
+
+error:
+    if (r_overlay.target)
+        trampoline_free((void *)r_overlay.target);
+
+    return -1;
+}
+
+// Patch function @fn, so that every time it is called, control is
+// transferred to @replacement.
+//
+// If @trampoline is provided, instructions destroyed in @fn are
+// transferred to @trampoline.
+int hook_install(void *fn, void *replacement, void *trampoline)
+{
+    return do_hook_install(fn, replacement, trampoline, 0);
+}
+
+int hook_install_alloc(void *fn, void *replacement, void **trampoline)
+{
+    void *t = trampoline_alloc(fn);
+
+    if (!t)
+        return -1;
+
+    if (do_hook_install(fn, replacement, t, 1) != 0) {
+        trampoline_free(t);
         return -1;
+    }
+
+    *trampoline = t;
+    return 0;
+}
+
+void *hook_alloc_code(void *near, const void *code, size_t len)
+{
+    if (len > HOOK_CODE_MAX) {
+        FORMAT_ERRMSG("%zu bytes of code, %d at most", len, HOOK_CODE_MAX);
+        return NULL;
+    }
+
+    void *p = trampoline_alloc(near);
+
+    if (!p)
+        return NULL;
 
-    return install_overlay(&fn_overlay);
+    if (install_bytes((uintptr_t)p, code, len) != 0) {
+        trampoline_free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+int hook_free_code(void *code)
+{
+    uint8_t int3[HOOK_CODE_MAX];
+
+    memset(int3, 0xcc, sizeof int3);
+    if (install_bytes((uintptr_t)code, int3, sizeof int3) != 0)
+        return -1;
+
+    trampoline_free(code);
+    return 0;
+}
+
+int hook_enable(void *fn)
+{
+    struct Hook *hook = find_hook(fn);
+
+    if (!hook) {
+        FORMAT_ERRMSG("%s is not hooked", funcname(fn));
+        return -1;
+    }
+
+    if (hook->enabled)
+        return 0;
+
+    if (install_bytes(hook->fn, hook->patched, hook->len) != 0)
+        return -1;
+
+    hook->enabled = 1;
+    return 0;
+}
+
+int hook_disable(void *fn)
+{
+    struct Hook *hook = find_hook(fn);
+
+    if (!hook) {
+        FORMAT_ERRMSG("%s is not hooked", funcname(fn));
+        return -1;
+    }
+
+    if (!hook->enabled)
+        return 0;
+
+    if (install_bytes(hook->fn, hook->original, hook->len) != 0)
+        return -1;
+
+    hook->enabled = 0;
+    return 0;
+}
+
+int hook_uninstall(void *fn)
+{
+    struct Hook *hook = find_hook(fn);
+
+    if (!hook) {
+        FORMAT_ERRMSG("%s is not hooked", funcname(fn));
+        return -1;
+    }
+
+    if (hook_disable(fn) != 0)
+        return -1;
+
+    // Back to the pristine state, so that the trampoline can be reused.
+    if (hook->trampoline) {
+        uint8_t int3[HOOK_SLOT_LEN];
+        const size_t len = hook->dynamic ? HOOK_SLOT_LEN : HOOK_TRAMPOLINE_LEN;
+
+        memset(int3, 0xcc, sizeof int3);
+        if (install_bytes(hook->trampoline, int3, len) != 0)
+            return -1;
+
+        if (hook->dynamic)
+            trampoline_free((void *)hook->trampoline);
+    }
+
+    if (hook->relay) {
+        uint8_t int3[HOOK_SLOT_LEN];
+
+        memset(int3, 0xcc, sizeof int3);
+        if (install_bytes(hook->relay, int3, sizeof int3) != 0)
+            return -1;
+
+        trampoline_free((void *)hook->relay);
+    }
+
+    *hook = g_hooks[--g_hooks_count];
+    return 0;
 }
 
 int hook_begin()
 {
-    if (g_mem_fd == -1) {
-        g_mem_fd = open("/proc/self/mem", O_WRONLY);
+    if (g_txn.active) {
+        FORMAT_ERRMSG("transaction already in progress");
+        return -1;
     }
 
+    g_txn.active       = 1;
+    g_txn.errors       = 0;
+    g_txn.writes_count = 0;
+    g_txn.hooks_count  = g_hooks_count;
+    g_txn.pages_count  = g_pages_count;
+    memcpy(g_txn.hooks, g_hooks, g_hooks_count * sizeof g_hooks[0]);
+    for (size_t i = 0; i < g_pages_count; i++)
+        g_txn.pages_used[i] = g_pages[i].used;
+
+    g_errmsg[0] = '\0';
     return 0;
 }
 
-void hook_end()
+static
+void rollback(void)
 {
+    g_hooks_count = g_txn.hooks_count;
+    memcpy(g_hooks, g_txn.hooks, g_hooks_count * sizeof g_hooks[0]);
+
+    // Pages mapped since stay, with all of their slots free.
+    for (size_t i = 0; i < g_pages_count; i++)
+        g_pages[i].used = i < g_txn.pages_count ? g_txn.pages_used[i] : 0;
+
+    g_txn.active = 0;
+}
+
+// A page touched by the transaction: its original content and the
+// content once all writes are applied, dirty in [lo, hi).
+struct PageImage
+{
+    uintptr_t base;
+    size_t    lo, hi;
+    uint8_t  *original;
+    uint8_t  *image;
+};
+
+static
+int compare_uintptr(const void *a, const void *b)
+{
+    const uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static
+struct PageImage *find_page(struct PageImage *pages, size_t count,
+                            uintptr_t base)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (pages[i].base == base)
+            return &pages[i];
+    }
+    return NULL;
+}
+
+static
+int commit(void)
+{
+    const size_t    page_size = sysconf(_SC_PAGESIZE);
+    const uintptr_t page_mask = page_size - 1;
+    uintptr_t       bases[HOOK_WRITES_MAX * 2];
+    size_t          count = 0;
+    int             rc = 0;
+
+    // Pages touched, a write spans two at most.
+    for (size_t i = 0; i < g_txn.writes_count; i++) {
+        const struct Write *w = &g_txn.writes[i];
+
+        bases[count++] = w->target & ~page_mask;
+        if (((w->target + w->len - 1) & ~page_mask) != bases[count - 1])
+            bases[count++] = (w->target + w->len - 1) & ~page_mask;
+    }
+
+    qsort(bases, count, sizeof bases[0], compare_uintptr);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!unique || bases[unique - 1] != bases[i])
+            bases[unique++] = bases[i];
+    }
+    count = unique;
+
+    if (!count)
+        return 0;
+
+    struct PageImage *pages = calloc(count, sizeof *pages);
+    uint8_t *buf = malloc(count * 2 * page_size);
+
+    if (!pages || !buf) {
+        FORMAT_ERRMSG("committing hooks: out of memory");
+        rc = -1;
+        goto out;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        pages[i].base     = bases[i];
+        pages[i].lo       = page_size;
+        pages[i].hi       = 0;
+        pages[i].original = buf + 2 * i * page_size;
+        pages[i].image    = pages[i].original + page_size;
+        memcpy(pages[i].original, (const void *)bases[i], page_size);
+        memcpy(pages[i].image, pages[i].original, page_size);
+    }
+
+    // Apply writes in order, later ones win.
+    for (size_t i = 0; i < g_txn.writes_count; i++) {
+        const struct Write *w = &g_txn.writes[i];
+        uintptr_t at = w->target;
+
+        while (at < w->target + w->len) {
+            struct PageImage *page = find_page(pages, count, at & ~page_mask);
+            const size_t off = at - page->base;
+            size_t len = w->target + w->len - at;
+
+            if (off + len > page_size)
+                len = page_size - off;
+
+            memcpy(page->image + off, w->code + (at - w->target), len);
+            if (off < page->lo) page->lo = off;
+            if (off + len > page->hi) page->hi = off + len;
+
+            at += len;
+        }
+    }
+
+    // One write per page; undo the pages done if one fails.
+    for (size_t i = 0; i < count; i++) {
+        struct PageImage *page = &pages[i];
+
+        if (write_code(page->base + page->lo, page->image + page->lo,
+                       page->hi - page->lo) == 0)
+            continue;
+
+        while (i-- > 0) {
+            page = &pages[i];
+            write_code(page->base + page->lo, page->original + page->lo,
+                       page->hi - page->lo);
+        }
+
+        rc = -1;
+        break;
+    }
+
+out:
+    free(buf);
+    free(pages);
+    return rc;
+}
+
+int hook_end()
+{
+    int rc = -1;
+
+    if (!g_txn.active) {
+        FORMAT_ERRMSG("no transaction in progress");
+        return -1;
+    }
+
+    if (g_mem_fd == -1)
+        g_mem_fd = open("/proc/self/mem", O_WRONLY);
+
+    if (commit() == 0) {
+        g_txn.active = 0;
+        rc = 0;
+    } else {
+        rollback();
+    }
+
     if (g_mem_fd != -1)
         close(g_mem_fd);
 
     g_mem_fd = - 1;
+
+    return rc;
+}
+
+void hook_abort()
+{
+    if (g_txn.active)
+        rollback();
 }
 
 const char *hook_last_error()
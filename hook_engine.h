@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -7,7 +9,8 @@ extern "C" {
 #ifdef __x86_64__
 
 // The length of a jump sequence a hooked function's code is clobbered
-// with.
+// with, at most. A 5 byte rel32 jump is used when the replacement (or a
+// relay stub next to the function) is within reach.
 #define HOOK_INITIAL_JUMP_LEN 12
 
 // The length of a jump sequence in trampoline's body. This is different
@@ -41,6 +44,12 @@ __asm__(".globl " HOOK_S(name) "\n" \
         ".local _J_" HOOK_S(name) "\n" \
         ".comm _J_" HOOK_S(name) ", " HOOK_S(HOOK_JUMP_MAX*8) ", 8\n")
 
+// Maximum number of hooks installed at once.
+#define HOOK_MAX              128
+
+// Maximum size of code allocated with hook_alloc_code().
+#define HOOK_CODE_MAX         128
+
 #else
 #error Unsupported ARCH :(
 #endif
@@ -56,14 +65,79 @@ __asm__(".globl " HOOK_S(name) "\n" \
 // Returns: 0 if succeeded, non-zero on error, check hook_last_error()
 int hook_install(void *fn, void *replacement, void *trampoline);
 
-// Install multiple hooks faster by enclosing calls to hook_install()
-// into hook_begin()/hook_end().
+// hook_install_alloc(fn, replacement, &trampoline)
+//
+// Same as hook_install(), but the trampoline is allocated on demand
+// from executable pages mapped within +-2GB of @fn. Calling
+// *@trampoline invokes the original @fn. Trampoline is released by
+// hook_uninstall().
+//
+// Returns: 0 if succeeded, non-zero on error, check hook_last_error()
+int hook_install_alloc(void *fn, void *replacement, void **trampoline);
+
+// hook_uninstall(fn)
+//
+// Restore the original code of function @fn hooked with hook_install().
+// The trampoline is reset and could be passed to hook_install() again.
+//
+// Must not be called while a call through the trampoline is in
+// progress.
+//
+// Returns: 0 if succeeded, non-zero on error, check hook_last_error()
+int hook_uninstall(void *fn);
+
+// hook_alloc_code(near, code, len)
+//
+// Copy @len bytes of @code, at most HOOK_CODE_MAX, to executable memory
+// within +-2GB of @near, allocated like hook_install_alloc()
+// trampolines. The memory is never made writable, the code is written
+// the way hooks are; in a transaction, it becomes visible at
+// hook_end(). Released by hook_free_code().
+//
+// Returns: the code address, NULL on error, check hook_last_error()
+void *hook_alloc_code(void *near, const void *code, size_t len);
+
+// Release code allocated with hook_alloc_code().
+//
+// Returns: 0 if succeeded, non-zero on error, check hook_last_error()
+int hook_free_code(void *code);
+
+// hook_disable(fn), hook_enable(fn)
+//
+// Temporarily restore the original code of function @fn hooked with
+// hook_install(), and patch it again. The trampoline stays intact and
+// keeps calling the original code.
+//
+// Returns: 0 if succeeded, non-zero on error, check hook_last_error()
+int hook_disable(void *fn);
+
+// See hook_disable().
+int hook_enable(void *fn);
+
+// Install multiple hooks as a transaction by enclosing calls to
+// hook_install() (and other functions patching code) into
+// hook_begin()/hook_end(). Code writes are queued and applied by
+// hook_end() at once, a single write per page. If any of them fails,
+// or hook_abort() is called instead, no code is changed and the hooks
+// registry is as it was at hook_begin().
+//
+// Errors of the calls within a transaction accumulate in
+// hook_last_error(), '; ' separated.
+//
+// A function can't be patched twice in a transaction, e.g. unhooked
+// and hooked again.
 //
 // Returns: 0 if succeeded, non-zero on error, check hook_last_error()
 int hook_begin(void);
 
-// See hook_begin().
-void hook_end(void);
+// Commit the transaction.
+//
+// Returns: 0 if succeeded, non-zero on error (everything rolled back),
+// check hook_last_error()
+int hook_end(void);
+
+// Roll the transaction back.
+void hook_abort(void);
 
 // hook_last_error(): Last error description string.
 //
@@ -113,5 +187,16 @@ inline int hook_install(Fn *fn, Fn *replacement, Fn *trampoline = nullptr)
                         (void *)replacement,
                         (void *)trampoline);
 }
+
+// hook_install_alloc(fn, replacement, &trampoline)
+//
+// Ensures functions compatibility.
+template<typename Fn, typename = typename std::enable_if<std::is_function<Fn>::value>::type>
+inline int hook_install_alloc(Fn *fn, Fn *replacement, Fn **trampoline)
+{
+    return hook_install_alloc((void *)fn,
+                              (void *)replacement,
+                              (void **)trampoline);
+}
 #endif
 
@@ -4,12 +4,20 @@ extern "C" {
 #include "postgres.h"
 }
 
+#include "perf_counters.h"
+#include "memory_usage.h"
+
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
+#include <map>
+#include <tuple>
 #include <iostream>
+#include <time.h>
 
 struct PgObject
 {
@@ -19,41 +27,410 @@ struct PgObject
                               // Path -> RelOptInfo -> PlannerInfo
     Oid                       oid = InvalidOid; // (RelOptInfo) relation's OID
     bool                      isChosen = false; // (Path) was used to build a plan
+    const char               *event = nullptr; // Hook the object was captured in
+    uint64_t                  timestamp = 0; // When captured in a hook, ns
+    std::string               costs; // (Path) cost breakdown, JSON
+    const void               *appendrel = nullptr; // (RelOptInfo) parent of
+                              // an appendrel member, e.g. a partition
     std::vector<const void *> backtrace;
 
     PgObject(const void *id_, const char *data_): id(id_), data(data_) {}
 };
 
+// Resources consumed, or a reading of the underlying counters.
+struct ResourceUsage
+{
+    uint64_t                  time = 0; // ns
+    int64_t                   memory = 0; // Planner memory context, bytes
+    PerfCounters              perf;
+
+    ResourceUsage &operator += (const ResourceUsage &other)
+    {
+        time += other.time;
+        memory += other.memory;
+        for (int i = 0; i < PERF_COUNTERS_MAX; i++)
+            perf.value[i] += other.perf.value[i];
+        return *this;
+    }
+
+    ResourceUsage operator - (const ResourceUsage &other) const
+    {
+        ResourceUsage res;
+        res.time = time - other.time;
+        res.memory = memory - other.memory;
+        for (int i = 0; i < PERF_COUNTERS_MAX; i++)
+            res.perf.value[i] = perf.value[i] - other.perf.value[i];
+        return res;
+    }
+};
+
+// A span of time spent in one of the planner's major functions.
+struct PlannerPhase
+{
+    const char               *name;
+    const void               *root; // PlannerInfo
+    uint64_t                  begin;
+    uint64_t                  end = 0;
+    ResourceUsage             start; // Reading at the beginning
+    ResourceUsage             usage; // Consumed, once ended
+
+    PlannerPhase(const char *name_, const void *root_,
+                 const ResourceUsage &start_):
+        name(name_), root(root_), begin(start_.time), start(start_) {}
+};
+
+// A join RelOptInfo as seen by the join search.
+struct JoinRel
+{
+    const void               *rel;
+    const void               *root; // PlannerInfo
+    std::string               relids; // Hex bitmap, bit N is RT index N
+    int                       level; // Number of base rels joined
+    size_t                    pairs = 0; // Pairs of input rels joined
+
+    JoinRel(const void *rel_, const void *root_, std::string relids_,
+            int level_):
+        rel(rel_), root(root_), relids(std::move(relids_)), level(level_) {}
+};
+
+// A join_search_one_level() invocation.
+struct JoinLevel
+{
+    const void               *root; // PlannerInfo
+    int                       level;
+    size_t                    phase; // Index in InstrumentationContext::phases
+    size_t                    pairs_tried = 0; // make_join_rel() calls
+    size_t                    rels_built = 0; // New join rels
+
+    JoinLevel(const void *root_, int level_, size_t phase_):
+        root(root_), level(level_), phase(phase_) {}
+};
+
+// An upper rel, one per grouping/window/ordering/final stage.
+struct UpperRel
+{
+    const void               *rel;
+    const void               *root; // PlannerInfo
+    int                       kind; // UpperRelationKind
+    const void               *input = nullptr; // Rel the stage consumed
+    size_t                    paths = 0;
+    size_t                    partial_paths = 0;
+
+    UpperRel(const void *rel_, const void *root_, int kind_):
+        rel(rel_), root(root_), kind(kind_) {}
+};
+
+// A path killed by another one in add_path().
+struct DominanceEdge
+{
+    const void               *winner; // Sample ids, winner nullptr if unknown
+    const void               *loser;
+    const char               *fate; // "rejected" on arrival or "evicted"
+    std::string               reason; // Criteria the winner was better on
+    bool                      partial; // add_partial_path()
+
+    DominanceEdge(const void *winner_, const void *loser_, const char *fate_,
+                  std::string reason_, bool partial_):
+        winner(winner_), loser(loser_), fate(fate_),
+        reason(std::move(reason_)), partial(partial_) {}
+};
+
+// Statistics a selectivity estimate was derived from.
+enum StatsSource
+{
+    STATS_SOURCE_MCV        = 1 << 0,
+    STATS_SOURCE_HISTOGRAM  = 1 << 1,
+    STATS_SOURCE_OTHER      = 1 << 2, // Other pg_statistic slot kinds
+    STATS_SOURCE_NDISTINCT  = 1 << 3,
+    STATS_SOURCE_DEFAULT    = 1 << 4  // Default ndistinct, no stats
+};
+
+// clause_selectivity() results for a clause, deduplicated across the
+// join orders it is evaluated in.
+struct ClauseEstimate
+{
+    const void               *clause;
+    const void               *rel; // RelOptInfo sized when first seen
+    int                       var_relid;
+    int                       jointype;
+    double                    selectivity = 0; // Last
+    unsigned                  sources = 0; // StatsSource
+    size_t                    calls = 0;
+    uint64_t                  time = 0;
+
+    ClauseEstimate(const void *clause_, const void *rel_, int var_relid_,
+                   int jointype_):
+        clause(clause_), rel(rel_), var_relid(var_relid_),
+        jointype(jointype_) {}
+};
+
+// set_baserel_size_estimates()/set_joinrel_size_estimates() outcome.
+struct RelEstimate
+{
+    const void               *rel;
+    double                    rows;
+    uint64_t                  time;
+
+    RelEstimate(const void *rel_, double rows_, uint64_t time_):
+        rel(rel_), rows(rows_), time(time_) {}
+};
+
+// GEQO generation summary; candidates' paths aren't retained.
+struct GeqoGeneration
+{
+    uint64_t                  begin;
+    uint64_t                  end = 0;
+    size_t                    evaluated = 0; // geqo_eval() calls
+    double                    best = 0; // Among evaluated
+    double                    worst = 0;
+    double                    pool_best = 0; // Fitness evolution
+    double                    pool_worst = 0;
+
+    explicit GeqoGeneration(uint64_t begin_): begin(begin_) {}
+};
+
+// A geqo() invocation. The first generation is the initial pool.
+struct GeqoRun
+{
+    const void               *root; // PlannerInfo
+    int                       rels;
+    std::vector<GeqoGeneration> generations;
+
+    GeqoRun(const void *root_, int rels_): root(root_), rels(rels_) {}
+};
+
+// Catalog lookups, syscache/relcache misses and time spent.
+struct CatalogAccess
+{
+    size_t                    lookups = 0;
+    size_t                    misses = 0;
+    uint64_t                  time = 0; // Outermost lookups only
+};
+
+// A syscache, by cache ID.
+struct SyscacheAccess
+{
+    const char               *catalog = nullptr; // Catalog the cache is on
+    CatalogAccess             access;
+};
+
+// Plan-time pruning of a partitioned/inheritance parent's children:
+// partition pruning on PG11+, constraint exclusion before that.
+struct PartitionPruning
+{
+    const void               *rel; // Parent RelOptInfo, sample id
+    const void               *root; // PlannerInfo
+    Oid                       oid;
+    const char               *method;
+    size_t                    partitions = 0; // Before pruning
+    size_t                    pruned = 0;
+    uint64_t                  time = 0;
+    bool                      runtime = false; // Run-time steps generated
+    std::vector<const void *> quals; // Parent's restriction clauses
+
+    PartitionPruning(const void *rel_, const void *root_, Oid oid_,
+                     const char *method_):
+        rel(rel_), root(root_), oid(oid_), method(method_) {}
+};
+
+// Heavyweight locks taken while planning.
+struct LockAcquisitions
+{
+    size_t                    locks = 0; // Newly acquired
+    size_t                    fast_path = 0; // Of those, via fast path
+    size_t                    already_held = 0; // Local lock table hits
+    uint64_t                  time = 0; // Including waits
+
+    LockAcquisitions &operator += (const LockAcquisitions &other)
+    {
+        locks += other.locks;
+        fast_path += other.fast_path;
+        already_held += other.already_held;
+        time += other.time;
+        return *this;
+    }
+};
+
+enum class ReportFormat
+{
+    Json,    // Planscape viewer
+    Trace,   // Chrome trace-event format, chrome://tracing or Perfetto
+    Counters // Summary counters in EXPLAIN output, no report file
+};
+
+enum class CaptureBackend
+{
+    Patch,   // Planner functions patched with hook_engine
+    Hooks    // Postgres hooks only, pathlists snapshotted once complete
+};
+
 struct InstrumentationContext
 {
+    ReportFormat                               format = ReportFormat::Json;
+    CaptureBackend                             backend = CaptureBackend::Patch;
+    uint64_t                                   queryid = 0; // Planned last
+    uint64_t                                   start_time = 0;
     std::unordered_map<const void *, size_t>   samples_index;
     std::vector<PgObject>                      samples;
+    // 'hooks' backend: signatures of objects captured, and ids made up
+    // for objects found where another one was captured before.
+    std::unordered_map<const void *, size_t>   signatures;
+    std::deque<char>                           synthetic_ids;
     std::unordered_set<Oid>                    types;
     std::unordered_set<Oid>                    functions;
     std::unordered_set<Oid>                    operators;
+    std::vector<PlannerPhase>                  phases;
+    std::unordered_map<const void *, size_t>   join_rels_index;
+    std::vector<JoinRel>                       join_rels;
+    std::vector<JoinLevel>                     join_levels;
+    size_t                                     join_level = SIZE_MAX; // Current
+    std::unordered_map<const void *, size_t>   upper_rels_index;
+    std::vector<UpperRel>                      upper_rels;
+    // PlannerInfo -> the final scan/join rel upper planning starts at.
+    std::unordered_map<const void *, const void *> current_rel;
+    bool                                       dominance_enabled = false;
+    std::vector<DominanceEdge>                 dominance;
+    std::map<std::tuple<const void *, int, int>, size_t> clause_estimates_index;
+    std::vector<ClauseEstimate>                clause_estimates;
+    std::vector<RelEstimate>                   rel_estimates;
+    const void                                *estimating_rel = nullptr;
+    size_t                                     clause_estimate = SIZE_MAX; // Current
+    size_t                                     clauselist_calls = 0;
+    uint64_t                                   clauselist_time = 0;
+    // Cost breakdowns of paths not added yet.
+    std::unordered_map<const void *, std::string> pending_costs;
+    // Catalog access during planning, see CatalogAccess. Attributed to
+    // the relation a RelOptInfo is being built or estimated for.
+    std::map<int, SyscacheAccess>              syscaches;
+    CatalogAccess                              relcache;
+    std::unordered_map<Oid, size_t>            catalog_scans; // By catalog
+    size_t                                     catalog_scans_total = 0;
+    std::unordered_map<Oid, CatalogAccess>     catalog_by_relation;
+    Oid                                        catalog_relation = InvalidOid;
+    int                                        catalog_depth = 0;
+    std::unordered_map<const void *, size_t>   partition_pruning_index;
+    std::vector<PartitionPruning>              partition_pruning;
+    std::unordered_map<Oid, LockAcquisitions>  locks_by_relation;
+    LockAcquisitions                           other_locks; // Non-relation
+    std::vector<GeqoRun>                       geqo_runs;
+    size_t                                     geqo_run = SIZE_MAX; // Current
+    bool                                       geqo_summarize = true;
+    bool                                       geqo_candidate = false; // Evaluating
+                                               // one, summarized
+    bool                                       fold_partitions = true;
+
+    // Resources consumed between hook points are charged to the
+    // RelOptInfo/PlannerInfo the later hook point is concerned with.
+    bool                                       perf = false;
+    bool                                       memory = false;
+    MemoryContext                              planner_context = nullptr;
+    ResourceUsage                              first_reading;
+    ResourceUsage                              last_reading;
+    std::unordered_map<const void *, ResourceUsage> usage;
+    ResourceUsage                              overhead; // Capture's own
+
+    // The counters group is only kept open for the capture.
+    ~InstrumentationContext()
+    {
+        if (perf)
+            perf_counters_close();
+    }
 };
 
+// Monotonic clock reading, ns.
+inline uint64_t capture_timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
 void clear_instrumentation_context(InstrumentationContext &ic);
 
 std::unique_ptr<InstrumentationContext>
-create_instrumentation_context();
+create_instrumentation_context(bool perf, bool memory);
+
+// Register invalidation callbacks for the catalog data reports carry.
+void report_cache_init();
 
 void make_report(std::ostream &os, const InstrumentationContext &ic);
 
+void make_trace_report(std::ostream &os, const InstrumentationContext &ic);
+
+// Name-value pairs summarizing the capture.
+std::vector<std::pair<std::string, std::string>>
+make_counters(const InstrumentationContext &ic);
+
+inline ResourceUsage read_resource_usage(const InstrumentationContext &ic)
+{
+    ResourceUsage reading;
+    reading.time = capture_timestamp();
+    if (ic.perf)
+        perf_counters_read(&reading.perf);
+    if (ic.memory && ic.planner_context)
+        reading.memory = memory_context_allocated(ic.planner_context);
+    return reading;
+}
+
+// Path to a module given dladdr()-reported name.
+std::string module_path(const char *dli_fname);
+
 std::string submit_report(const InstrumentationContext &ic, const char *url);
 
 inline void clear_instrumentation_context(InstrumentationContext &ic)
 {
     ic.samples_index.clear();
     ic.samples.clear();
+    ic.signatures.clear();
+    ic.synthetic_ids.clear();
     ic.types.clear();
     ic.functions.clear();
     ic.operators.clear();
+    ic.phases.clear();
+    ic.join_rels_index.clear();
+    ic.join_rels.clear();
+    ic.join_levels.clear();
+    ic.join_level = SIZE_MAX;
+    ic.upper_rels_index.clear();
+    ic.upper_rels.clear();
+    ic.current_rel.clear();
+    ic.dominance.clear();
+    ic.clause_estimates_index.clear();
+    ic.clause_estimates.clear();
+    ic.rel_estimates.clear();
+    ic.estimating_rel = nullptr;
+    ic.clause_estimate = SIZE_MAX;
+    ic.clauselist_calls = 0;
+    ic.clauselist_time = 0;
+    ic.pending_costs.clear();
+    ic.syscaches.clear();
+    ic.relcache = CatalogAccess();
+    ic.catalog_scans.clear();
+    ic.catalog_scans_total = 0;
+    ic.catalog_by_relation.clear();
+    ic.catalog_relation = InvalidOid;
+    ic.catalog_depth = 0;
+    ic.partition_pruning_index.clear();
+    ic.partition_pruning.clear();
+    ic.locks_by_relation.clear();
+    ic.other_locks = LockAcquisitions();
+    ic.geqo_runs.clear();
+    ic.geqo_run = SIZE_MAX;
+    ic.geqo_candidate = false;
+    ic.usage.clear();
+    ic.overhead = ResourceUsage();
+    ic.planner_context = nullptr;
+    ic.start_time = capture_timestamp();
+    ic.first_reading = ic.last_reading = read_resource_usage(ic);
 }
 
 inline std::unique_ptr<InstrumentationContext>
-create_instrumentation_context()
+create_instrumentation_context(bool perf, bool memory)
 {
     auto ic = std::make_unique<InstrumentationContext>();
+    ic->start_time = capture_timestamp();
+    ic->perf = perf && perf_counters_open();
+    ic->memory = memory;
+    ic->first_reading = ic->last_reading = read_resource_usage(*ic);
     return ic;
 }
@@ -0,0 +1,25 @@
+#include "memory_usage.h"
+
+extern "C" {
+#include "nodes/memnodes.h"
+}
+
+static void sum_context(MemoryContext context, MemoryContextCounters *totals)
+{
+#if PG_VERSION_NUM >= 110000
+    context->methods->stats(context, nullptr, nullptr, totals);
+#else
+    context->methods->stats(context, 0, false, totals);
+#endif
+
+    for (auto child = context->firstchild; child; child = child->nextchild)
+        sum_context(child, totals);
+}
+
+int64_t memory_context_allocated(MemoryContext context)
+{
+    MemoryContextCounters totals = {};
+
+    sum_context(context, &totals);
+    return totals.totalspace;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+extern "C" {
+#include "postgres.h"
+#include "utils/memutils.h"
+}
+
+// Bytes allocated from the OS by @context and its descendants, akin to
+// MemoryContextMemAllocated() from later Postgres versions.
+int64_t memory_context_allocated(MemoryContext context);
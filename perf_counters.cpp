@@ -0,0 +1,133 @@
+#include "perf_counters.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+namespace {
+
+struct EventDesc
+{
+    const char *name;
+    uint32_t    type;
+    uint64_t    config;
+};
+
+// The first event in a set is the group leader.
+const EventDesc hardware_events[] =
+{
+    {"cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"page-faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+const EventDesc software_events[] =
+{
+    {"task-clock",       PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"page-faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+static_assert(sizeof hardware_events / sizeof hardware_events[0] <= PERF_COUNTERS_MAX &&
+              sizeof software_events / sizeof software_events[0] <= PERF_COUNTERS_MAX,
+              "PERF_COUNTERS_MAX too small");
+
+}
+
+static int              g_fds[PERF_COUNTERS_MAX];
+static int              g_count;
+static const EventDesc *g_events;
+
+static int perf_event_open(const EventDesc &event, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = event.type;
+    attr.config = event.config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = group_fd == -1;
+    // Unprivileged users are typically restricted to user space for
+    // PMU events. Software ones are allowed kernel time, task-clock
+    // would otherwise miss the planner's system calls and faults.
+    attr.exclude_kernel = event.type == PERF_TYPE_HARDWARE;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+template<size_t N>
+static bool open_group(const EventDesc (&events)[N])
+{
+    for (size_t i = 0; i < N; i++) {
+
+        g_fds[i] = perf_event_open(events[i], i ? g_fds[0] : -1);
+
+        if (g_fds[i] == -1) {
+            int saved_errno = errno;
+            while (i--) close(g_fds[i]);
+            errno = saved_errno;
+            return false;
+        }
+    }
+
+    ioctl(g_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    g_count = N;
+    g_events = events;
+    return true;
+}
+
+bool perf_counters_open()
+{
+    if (g_count)
+        return true;
+
+    return open_group(hardware_events) || open_group(software_events);
+}
+
+void perf_counters_close()
+{
+    for (int i = 0; i < g_count; i++)
+        close(g_fds[i]);
+
+    g_count = 0;
+    g_events = nullptr;
+}
+
+int perf_counters_count()
+{
+    return g_count;
+}
+
+const char *perf_counters_name(int i)
+{
+    return g_events[i].name;
+}
+
+const char *perf_counters_source()
+{
+    return g_events == hardware_events ? "hardware (user space)" : "software";
+}
+
+bool perf_counters_read(PerfCounters *counters)
+{
+    // PERF_FORMAT_GROUP layout: nr, value[nr].
+    uint64_t buf[1 + PERF_COUNTERS_MAX];
+    const ssize_t size = sizeof(uint64_t) * (1 + g_count);
+
+    *counters = PerfCounters();
+
+    if (!g_count || read(g_fds[0], buf, size) != size)
+        return false;
+
+    for (int i = 0; i < g_count; i++)
+        counters->value[i] = buf[1 + i];
+
+    return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+// Counters read in one go with perf_event_open(2) group semantics.
+// Hardware events are tried first; if the PMU is unavailable (common on
+// VMs) software events are used instead.
+
+#define PERF_COUNTERS_MAX 4
+
+struct PerfCounters
+{
+    uint64_t value[PERF_COUNTERS_MAX] = {};
+};
+
+// Open the counters group for the calling thread, no-op if already
+// open.
+//
+// Returns: false if no events are available, check errno
+bool perf_counters_open();
+
+void perf_counters_close();
+
+// Number of events in the group, 0 if not open.
+int perf_counters_count();
+
+// Event name, i < perf_counters_count().
+const char *perf_counters_name(int i);
+
+// "hardware (user space)" or "software", hardware events exclude the
+// kernel.
+const char *perf_counters_source();
+
+// Returns: false on failure, @counters are zeroed
+bool perf_counters_read(PerfCounters *counters);
@@ -6,12 +6,30 @@ extern "C" {
 #include "nodes/plannodes.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/planmain.h"
+#include "optimizer/planner.h"
+#include "optimizer/paths.h"
+#include "optimizer/geqo.h"
+#include "optimizer/geqo_pool.h"
+#include "optimizer/cost.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
+#include "utils/catcache.h"
+#include "utils/relcache.h"
+#include "access/genam.h"
+#include "storage/lock.h"
+#include "optimizer/plancat.h"
+#if PG_VERSION_NUM >= 110000
+#include "partitioning/partprune.h"
+#endif
 #include "commands/explain.h"
 
 }
 
 #include "pg_hooks.h"
 #include "hook_engine.h"
+#include <assert.h>
+#include <vector>
+#include <algorithm>
 
 HOOK_DEFINE_TRAMPOLINE(__real__pfree);
 HOOK_DEFINE_TRAMPOLINE(__real__outNode);
@@ -19,53 +37,289 @@ HOOK_DEFINE_TRAMPOLINE(__real__add_path);
 HOOK_DEFINE_TRAMPOLINE(__real__add_partial_path);
 HOOK_DEFINE_TRAMPOLINE(__real__build_simple_rel);
 HOOK_DEFINE_TRAMPOLINE(__real__build_empty_join_rel);
+HOOK_DEFINE_TRAMPOLINE(__real__subquery_planner);
+HOOK_DEFINE_TRAMPOLINE(__real__query_planner);
+HOOK_DEFINE_TRAMPOLINE(__real__make_one_rel);
+HOOK_DEFINE_TRAMPOLINE(__real__standard_join_search);
+HOOK_DEFINE_TRAMPOLINE(__real__fetch_upper_rel);
+HOOK_DEFINE_TRAMPOLINE(__real__build_join_rel);
+HOOK_DEFINE_TRAMPOLINE(__real__make_join_rel);
+HOOK_DEFINE_TRAMPOLINE(__real__join_search_one_level);
+HOOK_DEFINE_TRAMPOLINE(__real__geqo);
+HOOK_DEFINE_TRAMPOLINE(__real__geqo_eval);
+HOOK_DEFINE_TRAMPOLINE(__real__spread_chromo);
+HOOK_DEFINE_TRAMPOLINE(__real__sort_pool);
+HOOK_DEFINE_TRAMPOLINE(__real__clause_selectivity);
+HOOK_DEFINE_TRAMPOLINE(__real__clauselist_selectivity);
+HOOK_DEFINE_TRAMPOLINE(__real__set_baserel_size_estimates);
+HOOK_DEFINE_TRAMPOLINE(__real__set_joinrel_size_estimates);
+HOOK_DEFINE_TRAMPOLINE(__real__get_attstatsslot);
+HOOK_DEFINE_TRAMPOLINE(__real__get_variable_numdistinct);
+HOOK_DEFINE_TRAMPOLINE(__real__cost_seqscan);
+HOOK_DEFINE_TRAMPOLINE(__real__cost_index);
+HOOK_DEFINE_TRAMPOLINE(__real__cost_bitmap_heap_scan);
+HOOK_DEFINE_TRAMPOLINE(__real__final_cost_nestloop);
+HOOK_DEFINE_TRAMPOLINE(__real__final_cost_mergejoin);
+HOOK_DEFINE_TRAMPOLINE(__real__final_cost_hashjoin);
+HOOK_DEFINE_TRAMPOLINE(__real__cost_sort);
+HOOK_DEFINE_TRAMPOLINE(__real__cost_agg);
+HOOK_DEFINE_TRAMPOLINE(__real__SearchCatCache);
+#if PG_VERSION_NUM >= 110000
+HOOK_DEFINE_TRAMPOLINE(__real__SearchCatCache1);
+HOOK_DEFINE_TRAMPOLINE(__real__SearchCatCache2);
+HOOK_DEFINE_TRAMPOLINE(__real__SearchCatCache3);
+HOOK_DEFINE_TRAMPOLINE(__real__SearchCatCache4);
+#endif
+HOOK_DEFINE_TRAMPOLINE(__real__RelationIdGetRelation);
+HOOK_DEFINE_TRAMPOLINE(__real__systable_beginscan);
+#if PG_VERSION_NUM >= 110000
+HOOK_DEFINE_TRAMPOLINE(__real__prune_append_rel_partitions);
+HOOK_DEFINE_TRAMPOLINE(__real__make_partition_pruneinfo);
+#else
+HOOK_DEFINE_TRAMPOLINE(__real__relation_excluded_by_constraints);
+#endif
+HOOK_DEFINE_TRAMPOLINE(__real__LockAcquireExtended);
 HOOK_DEFINE_TRAMPOLINE(__real__create_plan);
 HOOK_DEFINE_TRAMPOLINE(__real__ExplainPrintPlan);
 
+// Hooks installed, and the enable_hooks() calls in effect for each.
+static std::vector<void *> installed_hooks;
+static std::vector<int>    hooks_enabled;
+
+template<typename Fn>
+static int install(Fn *fn, Fn *replacement, Fn *trampoline)
+{
+    int rc = hook_install(fn, replacement, trampoline);
+    if (rc == 0)
+        installed_hooks.push_back(reinterpret_cast<void *>(fn));
+    return rc;
+}
+
 static bool do_install_hooks()
 {
     if (hook_begin() != 0) return false;
 
-    int rc;
+    // Attempt every hook, so that all failures are reported at once.
+    int rc = install(pfree, __wrap__pfree, __real__pfree);
 
-    rc = hook_install(pfree, __wrap__pfree, __real__pfree);
+    rc |= install(outNode, __wrap__outNode, __real__outNode);
 
-    if (rc == 0)
-        rc = hook_install(outNode, __wrap__outNode, __real__outNode);
+    rc |= install(add_path, __wrap__add_path, __real__add_path);
 
-    if (rc == 0)
-        rc = hook_install(add_path, __wrap__add_path, __real__add_path);
+    rc |= install(add_partial_path, __wrap__add_partial_path,
+                                         __real__add_partial_path);
 
-    if (rc == 0)
-        rc = hook_install(add_partial_path, __wrap__add_partial_path,
-                                            __real__add_partial_path);
+    rc |= install(build_simple_rel, __wrap__build_simple_rel,
+                                         __real__build_simple_rel);
 
-    if (rc == 0)
-        rc = hook_install(build_simple_rel, __wrap__build_simple_rel,
-                                            __real__build_simple_rel);
+    rc |= install(build_empty_join_rel, __wrap__build_empty_join_rel,
+                                             __real__build_empty_join_rel);
 
-    if (rc == 0)
-        rc = hook_install(build_empty_join_rel, __wrap__build_empty_join_rel,
-                                                __real__build_empty_join_rel);
+    rc |= install(subquery_planner, __wrap__subquery_planner,
+                                         __real__subquery_planner);
 
-    if (rc == 0)
-        rc = hook_install(create_plan, __wrap__create_plan,
-                                       __real__create_plan);
+    rc |= install(query_planner, __wrap__query_planner,
+                                      __real__query_planner);
 
-    if (rc == 0)
-        rc = hook_install(ExplainPrintPlan, __wrap__ExplainPrintPlan,
-                                            __real__ExplainPrintPlan);
+    rc |= install(make_one_rel, __wrap__make_one_rel,
+                                     __real__make_one_rel);
+
+    rc |= install(standard_join_search, __wrap__standard_join_search,
+                                             __real__standard_join_search);
+
+    rc |= install(fetch_upper_rel, __wrap__fetch_upper_rel,
+                                        __real__fetch_upper_rel);
+
+    rc |= install(build_join_rel, __wrap__build_join_rel,
+                                       __real__build_join_rel);
+
+    rc |= install(make_join_rel, __wrap__make_join_rel,
+                                      __real__make_join_rel);
+
+    rc |= install(join_search_one_level, __wrap__join_search_one_level,
+                                              __real__join_search_one_level);
+
+    rc |= install(geqo, __wrap__geqo, __real__geqo);
+
+    rc |= install(geqo_eval, __wrap__geqo_eval, __real__geqo_eval);
+
+    rc |= install(spread_chromo, __wrap__spread_chromo,
+                                      __real__spread_chromo);
+
+    rc |= install(sort_pool, __wrap__sort_pool, __real__sort_pool);
+
+    rc |= install(clause_selectivity, __wrap__clause_selectivity,
+                                           __real__clause_selectivity);
+
+    rc |= install(clauselist_selectivity, __wrap__clauselist_selectivity,
+                                               __real__clauselist_selectivity);
+
+    rc |= install(set_baserel_size_estimates,
+                       __wrap__set_baserel_size_estimates,
+                       __real__set_baserel_size_estimates);
+
+    rc |= install(set_joinrel_size_estimates,
+                       __wrap__set_joinrel_size_estimates,
+                       __real__set_joinrel_size_estimates);
+
+    rc |= install(get_attstatsslot, __wrap__get_attstatsslot,
+                                         __real__get_attstatsslot);
+
+    rc |= install(get_variable_numdistinct,
+                       __wrap__get_variable_numdistinct,
+                       __real__get_variable_numdistinct);
+
+    rc |= install(cost_seqscan, __wrap__cost_seqscan,
+                                     __real__cost_seqscan);
+
+    rc |= install(cost_index, __wrap__cost_index, __real__cost_index);
+
+    rc |= install(cost_bitmap_heap_scan, __wrap__cost_bitmap_heap_scan,
+                                              __real__cost_bitmap_heap_scan);
+
+    rc |= install(final_cost_nestloop, __wrap__final_cost_nestloop,
+                                            __real__final_cost_nestloop);
+
+    rc |= install(final_cost_mergejoin, __wrap__final_cost_mergejoin,
+                                             __real__final_cost_mergejoin);
+
+    rc |= install(final_cost_hashjoin, __wrap__final_cost_hashjoin,
+                                            __real__final_cost_hashjoin);
+
+    rc |= install(cost_sort, __wrap__cost_sort, __real__cost_sort);
+
+    rc |= install(cost_agg, __wrap__cost_agg, __real__cost_agg);
+
+    rc |= install(SearchCatCache, __wrap__SearchCatCache,
+                                       __real__SearchCatCache);
+
+#if PG_VERSION_NUM >= 110000
+    rc |= install(SearchCatCache1, __wrap__SearchCatCache1,
+                                        __real__SearchCatCache1);
 
-    hook_end();
+    rc |= install(SearchCatCache2, __wrap__SearchCatCache2,
+                                        __real__SearchCatCache2);
 
+    rc |= install(SearchCatCache3, __wrap__SearchCatCache3,
+                                        __real__SearchCatCache3);
+
+    rc |= install(SearchCatCache4, __wrap__SearchCatCache4,
+                                        __real__SearchCatCache4);
+#endif
+
+    rc |= install(RelationIdGetRelation, __wrap__RelationIdGetRelation,
+                                              __real__RelationIdGetRelation);
+
+    rc |= install(systable_beginscan, __wrap__systable_beginscan,
+                                           __real__systable_beginscan);
+
+#if PG_VERSION_NUM >= 110000
+    rc |= install(prune_append_rel_partitions,
+                       __wrap__prune_append_rel_partitions,
+                       __real__prune_append_rel_partitions);
+
+    rc |= install(make_partition_pruneinfo,
+                       __wrap__make_partition_pruneinfo,
+                       __real__make_partition_pruneinfo);
+#else
+    rc |= install(relation_excluded_by_constraints,
+                       __wrap__relation_excluded_by_constraints,
+                       __real__relation_excluded_by_constraints);
+#endif
+
+    rc |= install(LockAcquireExtended, __wrap__LockAcquireExtended,
+                                            __real__LockAcquireExtended);
+
+    rc |= install(create_plan, __wrap__create_plan,
+                                    __real__create_plan);
+
+    rc |= install(ExplainPrintPlan, __wrap__ExplainPrintPlan,
+                                         __real__ExplainPrintPlan);
+
+    // Idle until enable_hooks().
+    for (size_t i = 0; i < installed_hooks.size() && rc == 0; i++)
+        rc = hook_disable(installed_hooks[i]);
+
+    if (rc != 0)
+        hook_abort();
+    else
+        rc = hook_end();
+
+    // Nothing was patched.
+    if (rc != 0)
+        installed_hooks.clear();
+
+    hooks_enabled.assign(installed_hooks.size(), 0);
     return rc == 0;
 }
 
 bool install_hooks()
 {
     // Install hooks once. Doing it multiple times is not just
-    // inefficient, but harmfull.
-    static bool res = do_install_hooks();
+    // inefficient, but harmfull. A failed attempt leaves no trace
+    // and is retried.
+    static bool installed = false;
+
+    if (!installed)
+        installed = do_install_hooks();
+
+    return installed;
+}
 
-    return res;
+// Add @delta to the enable count of hooks @fns, patching those that
+// become enabled or disabled in a single transaction.
+static bool update_hooks_enabled(const std::vector<void *> &fns, int delta)
+{
+    std::vector<size_t> hooks;
+
+    for (void *fn: fns) {
+        auto it = std::find(installed_hooks.begin(), installed_hooks.end(), fn);
+        assert(it != installed_hooks.end());
+        hooks.push_back(it - installed_hooks.begin());
+    }
+
+    if (hook_begin() != 0) return false;
+
+    int rc = 0;
+    for (size_t i = 0; i < hooks.size() && rc == 0; i++) {
+        const int enabled = hooks_enabled[hooks[i]];
+
+        if (delta > 0 && enabled == 0)
+            rc = hook_enable(installed_hooks[hooks[i]]);
+        else if (delta < 0 && enabled == 1)
+            rc = hook_disable(installed_hooks[hooks[i]]);
+    }
+
+    if (rc != 0)
+        hook_abort();
+    else
+        rc = hook_end();
+
+    // A hook failing to disable is still let go.
+    if (rc == 0 || delta < 0) {
+        for (size_t hook: hooks)
+            hooks_enabled[hook] += delta;
+    }
+
+    return rc == 0;
+}
+
+bool enable_hooks()
+{
+    return update_hooks_enabled(installed_hooks, 1);
+}
+
+void disable_hooks()
+{
+    update_hooks_enabled(installed_hooks, -1);
+}
+
+bool enable_hooks(const std::vector<void *> &fns)
+{
+    return update_hooks_enabled(fns, 1);
+}
+
+void disable_hooks(const std::vector<void *> &fns)
+{
+    update_hooks_enabled(fns, -1);
 }
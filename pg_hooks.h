@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 extern "C" {
 
 void __wrap__pfree(void *pointer);
@@ -31,12 +33,298 @@ RelOptInfo * __real__build_simple_rel(PlannerInfo *root,
 RelOptInfo * __wrap__build_empty_join_rel(PlannerInfo *root);
 RelOptInfo * __real__build_empty_join_rel(PlannerInfo *root);
 
-// Not hooking
-//   build_join_rel,
-//   fetch_upper_rel.
-// As of 9.6, there are only 4 functions producing RelOptInfo-s, and we
-// only care about simple rels. We can't get underliing relation ID from
-// RelOptInfo alone.
+// Join search: the join rels built and the pairs of rels tried.
+RelOptInfo *__wrap__build_join_rel(PlannerInfo *root,
+                                   Relids joinrelids,
+                                   RelOptInfo *outer_rel,
+                                   RelOptInfo *inner_rel,
+                                   SpecialJoinInfo *sjinfo,
+                                   List **restrictlist_ptr);
+RelOptInfo *__real__build_join_rel(PlannerInfo *root,
+                                   Relids joinrelids,
+                                   RelOptInfo *outer_rel,
+                                   RelOptInfo *inner_rel,
+                                   SpecialJoinInfo *sjinfo,
+                                   List **restrictlist_ptr);
+
+RelOptInfo *__wrap__make_join_rel(PlannerInfo *root,
+                                  RelOptInfo *rel1, RelOptInfo *rel2);
+RelOptInfo *__real__make_join_rel(PlannerInfo *root,
+                                  RelOptInfo *rel1, RelOptInfo *rel2);
+
+void __wrap__join_search_one_level(PlannerInfo *root, int level);
+void __real__join_search_one_level(PlannerInfo *root, int level);
+
+// GEQO: geqo() runs generations, geqo_eval() builds and discards a
+// join tree per candidate tour, spread_chromo() ends a generation.
+RelOptInfo *__wrap__geqo(PlannerInfo *root, int number_of_rels,
+                         List *initial_rels);
+RelOptInfo *__real__geqo(PlannerInfo *root, int number_of_rels,
+                         List *initial_rels);
+
+Cost __wrap__geqo_eval(PlannerInfo *root, Gene *tour, int num_gene);
+Cost __real__geqo_eval(PlannerInfo *root, Gene *tour, int num_gene);
+
+void __wrap__spread_chromo(PlannerInfo *root, Chromosome *chromo,
+                           Pool *pool);
+void __real__spread_chromo(PlannerInfo *root, Chromosome *chromo,
+                           Pool *pool);
+
+// Called once, when the initial pool is ready.
+void __wrap__sort_pool(PlannerInfo *root, Pool *pool);
+void __real__sort_pool(PlannerInfo *root, Pool *pool);
+
+// Upper rels, one per (stage kind, relids).
+RelOptInfo *__wrap__fetch_upper_rel(PlannerInfo *root,
+                                    UpperRelationKind kind,
+                                    Relids relids);
+RelOptInfo *__real__fetch_upper_rel(PlannerInfo *root,
+                                    UpperRelationKind kind,
+                                    Relids relids);
+
+// Planner phases, see PlannerPhase. grouping_planner() is static, the
+// time it spends past query_planner() shows up in subquery_planner().
+PlannerInfo *__wrap__subquery_planner(PlannerGlobal *glob, Query *parse,
+                                      PlannerInfo *parent_root,
+                                      bool hasRecursion,
+                                      double tuple_fraction);
+PlannerInfo *__real__subquery_planner(PlannerGlobal *glob, Query *parse,
+                                      PlannerInfo *parent_root,
+                                      bool hasRecursion,
+                                      double tuple_fraction);
+
+RelOptInfo *__wrap__query_planner(PlannerInfo *root, List *tlist,
+                                  query_pathkeys_callback qp_callback,
+                                  void *qp_extra);
+RelOptInfo *__real__query_planner(PlannerInfo *root, List *tlist,
+                                  query_pathkeys_callback qp_callback,
+                                  void *qp_extra);
+
+RelOptInfo *__wrap__make_one_rel(PlannerInfo *root, List *joinlist);
+RelOptInfo *__real__make_one_rel(PlannerInfo *root, List *joinlist);
+
+RelOptInfo *__wrap__standard_join_search(PlannerInfo *root,
+                                         int levels_needed,
+                                         List *initial_rels);
+RelOptInfo *__real__standard_join_search(PlannerInfo *root,
+                                         int levels_needed,
+                                         List *initial_rels);
+
+// Cardinality estimation.
+Selectivity __wrap__clause_selectivity(PlannerInfo *root, Node *clause,
+                                       int varRelid, JoinType jointype,
+                                       SpecialJoinInfo *sjinfo);
+Selectivity __real__clause_selectivity(PlannerInfo *root, Node *clause,
+                                       int varRelid, JoinType jointype,
+                                       SpecialJoinInfo *sjinfo);
+
+Selectivity __wrap__clauselist_selectivity(PlannerInfo *root, List *clauses,
+                                           int varRelid, JoinType jointype,
+                                           SpecialJoinInfo *sjinfo);
+Selectivity __real__clauselist_selectivity(PlannerInfo *root, List *clauses,
+                                           int varRelid, JoinType jointype,
+                                           SpecialJoinInfo *sjinfo);
+
+void __wrap__set_baserel_size_estimates(PlannerInfo *root, RelOptInfo *rel);
+void __real__set_baserel_size_estimates(PlannerInfo *root, RelOptInfo *rel);
+
+void __wrap__set_joinrel_size_estimates(PlannerInfo *root, RelOptInfo *rel,
+                                        RelOptInfo *outer_rel,
+                                        RelOptInfo *inner_rel,
+                                        SpecialJoinInfo *sjinfo,
+                                        List *restrictlist);
+void __real__set_joinrel_size_estimates(PlannerInfo *root, RelOptInfo *rel,
+                                        RelOptInfo *outer_rel,
+                                        RelOptInfo *inner_rel,
+                                        SpecialJoinInfo *sjinfo,
+                                        List *restrictlist);
+
+// Statistics consulted by selectivity estimators.
+#if PG_VERSION_NUM >= 100000
+bool __wrap__get_attstatsslot(AttStatsSlot *sslot, HeapTuple statstuple,
+                              int reqkind, Oid reqop, int flags);
+bool __real__get_attstatsslot(AttStatsSlot *sslot, HeapTuple statstuple,
+                              int reqkind, Oid reqop, int flags);
+#else
+bool __wrap__get_attstatsslot(HeapTuple statstuple,
+                              Oid atttype, int32 atttypmod,
+                              int reqkind, Oid reqop,
+                              Oid *actualop,
+                              Datum **values, int *nvalues,
+                              float4 **numbers, int *nnumbers);
+bool __real__get_attstatsslot(HeapTuple statstuple,
+                              Oid atttype, int32 atttypmod,
+                              int reqkind, Oid reqop,
+                              Oid *actualop,
+                              Datum **values, int *nvalues,
+                              float4 **numbers, int *nnumbers);
+#endif
+
+double __wrap__get_variable_numdistinct(VariableStatData *vardata,
+                                        bool *isdefault);
+double __real__get_variable_numdistinct(VariableStatData *vardata,
+                                        bool *isdefault);
+
+// Costing. Breakdowns are attached to paths once added.
+#if PG_VERSION_NUM >= 100000
+#define COST_INDEX_PARAMS     double loop_count, bool partial_path
+#define COST_INDEX_ARGS       loop_count, partial_path
+#define FINAL_COST_PARAMS     JoinPathExtraData *extra
+#define FINAL_COST_ARGS       extra
+#else
+#define COST_INDEX_PARAMS     double loop_count
+#define COST_INDEX_ARGS       loop_count
+#define FINAL_COST_PARAMS     SpecialJoinInfo *sjinfo, \
+                              SemiAntiJoinFactors *semifactors
+#define FINAL_COST_ARGS       sjinfo, semifactors
+#endif
+
+void __wrap__cost_seqscan(Path *path, PlannerInfo *root,
+                          RelOptInfo *baserel, ParamPathInfo *param_info);
+void __real__cost_seqscan(Path *path, PlannerInfo *root,
+                          RelOptInfo *baserel, ParamPathInfo *param_info);
+
+void __wrap__cost_index(IndexPath *path, PlannerInfo *root,
+                        COST_INDEX_PARAMS);
+void __real__cost_index(IndexPath *path, PlannerInfo *root,
+                        COST_INDEX_PARAMS);
+
+void __wrap__cost_bitmap_heap_scan(Path *path, PlannerInfo *root,
+                                   RelOptInfo *baserel,
+                                   ParamPathInfo *param_info,
+                                   Path *bitmapqual, double loop_count);
+void __real__cost_bitmap_heap_scan(Path *path, PlannerInfo *root,
+                                   RelOptInfo *baserel,
+                                   ParamPathInfo *param_info,
+                                   Path *bitmapqual, double loop_count);
+
+void __wrap__final_cost_nestloop(PlannerInfo *root, NestPath *path,
+                                 JoinCostWorkspace *workspace,
+                                 FINAL_COST_PARAMS);
+void __real__final_cost_nestloop(PlannerInfo *root, NestPath *path,
+                                 JoinCostWorkspace *workspace,
+                                 FINAL_COST_PARAMS);
+
+void __wrap__final_cost_mergejoin(PlannerInfo *root, MergePath *path,
+                                  JoinCostWorkspace *workspace,
+                                  FINAL_COST_PARAMS);
+void __real__final_cost_mergejoin(PlannerInfo *root, MergePath *path,
+                                  JoinCostWorkspace *workspace,
+                                  FINAL_COST_PARAMS);
+
+void __wrap__final_cost_hashjoin(PlannerInfo *root, HashPath *path,
+                                 JoinCostWorkspace *workspace,
+                                 FINAL_COST_PARAMS);
+void __real__final_cost_hashjoin(PlannerInfo *root, HashPath *path,
+                                 JoinCostWorkspace *workspace,
+                                 FINAL_COST_PARAMS);
+
+void __wrap__cost_sort(Path *path, PlannerInfo *root,
+                       List *pathkeys, Cost input_cost, double tuples,
+                       int width, Cost comparison_cost,
+                       int sort_mem, double limit_tuples);
+void __real__cost_sort(Path *path, PlannerInfo *root,
+                       List *pathkeys, Cost input_cost, double tuples,
+                       int width, Cost comparison_cost,
+                       int sort_mem, double limit_tuples);
+
+void __wrap__cost_agg(Path *path, PlannerInfo *root,
+                      AggStrategy aggstrategy,
+                      const AggClauseCosts *aggcosts,
+                      int numGroupCols, double numGroups,
+                      Cost input_startup_cost, Cost input_total_cost,
+                      double input_tuples);
+void __real__cost_agg(Path *path, PlannerInfo *root,
+                      AggStrategy aggstrategy,
+                      const AggClauseCosts *aggcosts,
+                      int numGroupCols, double numGroups,
+                      Cost input_startup_cost, Cost input_total_cost,
+                      double input_tuples);
+
+// Catalog access: syscache and relcache lookups, catalog scans.
+HeapTuple __wrap__SearchCatCache(CatCache *cache,
+                                 Datum v1, Datum v2, Datum v3, Datum v4);
+HeapTuple __real__SearchCatCache(CatCache *cache,
+                                 Datum v1, Datum v2, Datum v3, Datum v4);
+
+#if PG_VERSION_NUM >= 110000
+// SearchSysCacheN() entry points.
+HeapTuple __wrap__SearchCatCache1(CatCache *cache, Datum v1);
+HeapTuple __real__SearchCatCache1(CatCache *cache, Datum v1);
+
+HeapTuple __wrap__SearchCatCache2(CatCache *cache, Datum v1, Datum v2);
+HeapTuple __real__SearchCatCache2(CatCache *cache, Datum v1, Datum v2);
+
+HeapTuple __wrap__SearchCatCache3(CatCache *cache,
+                                  Datum v1, Datum v2, Datum v3);
+HeapTuple __real__SearchCatCache3(CatCache *cache,
+                                  Datum v1, Datum v2, Datum v3);
+
+HeapTuple __wrap__SearchCatCache4(CatCache *cache,
+                                  Datum v1, Datum v2, Datum v3, Datum v4);
+HeapTuple __real__SearchCatCache4(CatCache *cache,
+                                  Datum v1, Datum v2, Datum v3, Datum v4);
+#endif
+
+Relation __wrap__RelationIdGetRelation(Oid relationId);
+Relation __real__RelationIdGetRelation(Oid relationId);
+
+SysScanDesc __wrap__systable_beginscan(Relation heapRelation, Oid indexId,
+                                       bool indexOK, Snapshot snapshot,
+                                       int nkeys, ScanKey key);
+SysScanDesc __real__systable_beginscan(Relation heapRelation, Oid indexId,
+                                       bool indexOK, Snapshot snapshot,
+                                       int nkeys, ScanKey key);
+
+// Plan-time partition pruning.
+#if PG_VERSION_NUM >= 110000
+Relids __wrap__prune_append_rel_partitions(RelOptInfo *rel);
+Relids __real__prune_append_rel_partitions(RelOptInfo *rel);
+
+#if PG_VERSION_NUM >= 140000
+#define PRUNEINFO_PARAMS      List *prunequal
+#define PRUNEINFO_ARGS        prunequal
+#else
+#define PRUNEINFO_PARAMS      List *partitioned_rels, List *prunequal
+#define PRUNEINFO_ARGS        partitioned_rels, prunequal
+#endif
+
+PartitionPruneInfo *__wrap__make_partition_pruneinfo(PlannerInfo *root,
+                                                     RelOptInfo *parentrel,
+                                                     List *subpaths,
+                                                     PRUNEINFO_PARAMS);
+PartitionPruneInfo *__real__make_partition_pruneinfo(PlannerInfo *root,
+                                                     RelOptInfo *parentrel,
+                                                     List *subpaths,
+                                                     PRUNEINFO_PARAMS);
+#else
+bool __wrap__relation_excluded_by_constraints(PlannerInfo *root,
+                                              RelOptInfo *rel,
+                                              RangeTblEntry *rte);
+bool __real__relation_excluded_by_constraints(PlannerInfo *root,
+                                              RelOptInfo *rel,
+                                              RangeTblEntry *rte);
+#endif
+
+// Heavyweight locks.
+#if PG_VERSION_NUM >= 120000
+#define LOCK_ACQUIRE_PARAMS   bool reportMemoryError, LOCALLOCK **locallockp
+#define LOCK_ACQUIRE_ARGS     reportMemoryError, locallockp
+#else
+#define LOCK_ACQUIRE_PARAMS   bool reportMemoryError
+#define LOCK_ACQUIRE_ARGS     reportMemoryError
+#endif
+
+LockAcquireResult __wrap__LockAcquireExtended(const LOCKTAG *locktag,
+                                              LOCKMODE lockmode,
+                                              bool sessionLock,
+                                              bool dontWait,
+                                              LOCK_ACQUIRE_PARAMS);
+LockAcquireResult __real__LockAcquireExtended(const LOCKTAG *locktag,
+                                              LOCKMODE lockmode,
+                                              bool sessionLock,
+                                              bool dontWait,
+                                              LOCK_ACQUIRE_PARAMS);
 
 Plan *__wrap__create_plan(PlannerInfo *root, Path *best_path);
 Plan *__real__create_plan(PlannerInfo *root, Path *best_path);
@@ -48,3 +336,16 @@ void __real__ExplainPrintPlan(ExplainState *es, QueryDesc *queryDesc);
 
 bool install_hooks();
 
+// Hooks are installed disabled: the original code runs until
+// enable_hooks(). Calls nest, the outermost disable_hooks() restores
+// the original code again.
+bool enable_hooks();
+
+void disable_hooks();
+
+// Same, for the hooks of functions @fns only. Nesting is tracked per
+// hook, together with the calls above.
+bool enable_hooks(const std::vector<void *> &fns);
+
+void disable_hooks(const std::vector<void *> &fns);
+
@@ -0,0 +1,70 @@
+/* planscape--1.0.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION planscape" to load this file. \quit
+
+-- Runtime function tracing, backend-local.
+CREATE FUNCTION planscape_trace_function(name text)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION planscape_untrace_function(name text)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION planscape_trace_stats(
+    OUT function text,
+    OUT traced bool,
+    OUT calls int8,
+    OUT total_time float8,
+    OUT histogram int8[]
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW planscape_trace_stats AS
+  SELECT * FROM planscape_trace_stats();
+
+-- Patching code is not for everyone.
+REVOKE ALL ON FUNCTION planscape_trace_function(text) FROM PUBLIC;
+REVOKE ALL ON FUNCTION planscape_untrace_function(text) FROM PUBLIC;
+
+-- Planning statistics by statement, needs shared_preload_libraries.
+CREATE FUNCTION planscape_stats(
+    OUT dbid oid,
+    OUT queryid int8,
+    OUT plans int8,
+    OUT total_plan_time float8,
+    OUT max_plan_time float8,
+    OUT paths int8,
+    OUT join_rels int8,
+    OUT captures int8,
+    OUT capture_time float8
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW planscape_stats AS
+  SELECT * FROM planscape_stats();
+
+GRANT SELECT ON planscape_stats TO PUBLIC;
+
+CREATE FUNCTION planscape_stats_reset()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+REVOKE ALL ON FUNCTION planscape_stats_reset() FROM PUBLIC;
+
+-- Capture the next planner invocations of another backend, needs
+-- shared_preload_libraries.
+CREATE FUNCTION planscape_capture_backend(pid int, count int DEFAULT 1)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION planscape_capture_backend(int, int) FROM PUBLIC;
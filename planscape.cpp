@@ -7,6 +7,35 @@ extern "C" {
 #include "commands/explain.h"
 #include "tcop/utility.h"
 #include "commands/defrem.h"
+#include "optimizer/planmain.h"
+#include "optimizer/planner.h"
+#include "optimizer/paths.h"
+#include "optimizer/geqo.h"
+#include "optimizer/geqo_pool.h"
+#include "optimizer/cost.h"
+#include "utils/guc.h"
+#include "utils/selfuncs.h"
+#include "utils/spccache.h"
+#include "catalog/pg_statistic.h"
+#include "access/htup_details.h"
+#include "access/genam.h"
+#include "utils/catcache.h"
+#include "storage/lock.h"
+#include "storage/proc.h"
+#include "optimizer/plancat.h"
+#include "optimizer/pathnode.h"
+#if PG_VERSION_NUM >= 110000
+#include "partitioning/partprune.h"
+#endif
+#include "miscadmin.h"
+#include "funcapi.h"
+#include "catalog/pg_type.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "storage/ipc.h"
+#include "access/xact.h"
+#include "utils/resowner.h"
+#include "utils/hsearch.h"
 
 #pragma GCC visibility push(default)
 
@@ -14,22 +43,104 @@ PG_MODULE_MAGIC;
 
 void _PG_init();
 
+PG_FUNCTION_INFO_V1(planscape_trace_function);
+PG_FUNCTION_INFO_V1(planscape_untrace_function);
+PG_FUNCTION_INFO_V1(planscape_trace_stats);
+PG_FUNCTION_INFO_V1(planscape_stats);
+PG_FUNCTION_INFO_V1(planscape_stats_reset);
+PG_FUNCTION_INFO_V1(planscape_capture_backend);
+
 #pragma GCC visibility pop
 }
 
 #include "pg_hooks.h"
 #include "hook_engine.h"
 #include "instrumentation_context.h"
+#include "profiler.h"
+#include "tracer.h"
+#include "events.h"
+#include "stats.h"
+#include "arm.h"
 #include <sys/stat.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <assert.h>
 #include <execinfo.h>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
 
 // Postgres ProcessUtility hook bookkeeping.
 static ProcessUtility_hook_type process_utility_hook_next = nullptr;
 
+// Postgres planner hook bookkeeping.
+static planner_hook_type planner_hook_next = nullptr;
+
+// Shared memory startup hook bookkeeping.
+static shmem_startup_hook_type shmem_startup_hook_next = nullptr;
+
+// Path generation hooks bookkeeping, used by the 'hooks' capture
+// backend.
+static set_rel_pathlist_hook_type set_rel_pathlist_hook_next = nullptr;
+static set_join_pathlist_hook_type set_join_pathlist_hook_next = nullptr;
+static create_upper_paths_hook_type create_upper_paths_hook_next = nullptr;
+
+// Nesting level of planner() calls.
+static int planner_depth = 0;
+
+// GUC planscape.profile_frequency: sampling profiler frequency, Hz;
+// 0 disables the profiler.
+static int profile_frequency = 0;
+
+// GUC planscape.perf_counters: read perf_event counters at hook points.
+static bool perf_counters_enabled = false;
+
+// GUC planscape.track_memory: measure planner memory context growth at
+// hook points.
+static bool track_memory = false;
+
+// GUC planscape.fold_partitions: fold structurally identical sibling
+// partitions in the report.
+static bool fold_partitions = true;
+
+// GUC planscape.capture_backend: patch planner functions or rely on
+// the hooks Postgres provides.
+static int capture_backend = int(CaptureBackend::Patch);
+
+static const struct config_enum_entry capture_backend_options[] = {
+    {"patch", int(CaptureBackend::Patch), false},
+    {"hooks", int(CaptureBackend::Hooks), false},
+    {nullptr, 0, false}
+};
+
+// Hooks were installed and enabled by the postmaster.
+static bool hooks_preloaded = false;
+
+// GUC planscape.track_stats: record planning statistics by statement
+// in shared memory.
+static bool track_stats = true;
+
+// GUC planscape.max_stats: statements tracked, at most.
+static int max_stats = 5000;
+
+// GUC planscape.spool_directory: where captures armed remotely write
+// their reports.
+static char *spool_directory = nullptr;
+
+// my_arm_slot points at the backend's slot.
+static bool arm_attached = false;
+
+// Counters of the statement being planned, if tracked.
+static PlanningCounters *planning_counters = nullptr;
+
+// GUC planscape.geqo_summarize: summarize GEQO generations instead of
+// capturing every candidate join tree.
+static bool geqo_summarize = true;
+
+// GUC planscape.track_dominance: record which path killed which in
+// add_path().
+static bool track_dominance = false;
+
 // Activates certain additional functionality implemented by outNode
 // hook, used by capture_object().
 static const void *inCaptureObject = nullptr;
@@ -199,6 +310,13 @@ static PgObject &capture_proxy(const void *p)
     return *desc;
 }
 
+// Capturing, and not within a GEQO candidate being summarized: paths,
+// rels, estimates and cost breakdowns are to be recorded.
+static bool recording_objects()
+{
+    return ic && !ic->geqo_candidate;
+}
+
 static PgObject &capture_backtrace(PgObject &desc, int level)
     __attribute__((noinline));
 
@@ -207,29 +325,459 @@ static PgObject &capture_backtrace(PgObject &desc, int level)
     constexpr size_t FRAMES_MAX = 32;
     const void * bt[FRAMES_MAX];
 
-    desc.backtrace.assign(bt + level + 1,
-            bt+backtrace(const_cast<void**>(bt), FRAMES_MAX));
+    const int depth = backtrace(const_cast<void**>(bt), FRAMES_MAX);
+
+    tracer_resolve_backtrace(const_cast<void**>(bt), depth);
+    desc.backtrace.assign(bt + level + 1, bt + depth);
     return desc;
 }
 
+// Stamp an object captured by a hook with the hook name and time, so
+// that planning could be laid out on a timeline.
+static PgObject &capture_event(PgObject &desc, const char *event)
+{
+    desc.event = event;
+    desc.timestamp = capture_timestamp();
+    return desc;
+}
+
+// Charge resources consumed since the previous hook point to @owner.
+static const ResourceUsage &charge_usage(const void *owner)
+{
+    auto reading = read_resource_usage(*ic);
+
+    if (owner)
+        ic->usage[owner] += reading - ic->last_reading;
+
+    ic->last_reading = reading;
+    return ic->last_reading;
+}
+
+// Resources consumed since the previous hook point went into capture,
+// don't charge them to the planner.
+static void exclude_capture()
+{
+    auto reading = read_resource_usage(*ic);
+    ic->overhead += reading - ic->last_reading;
+    ic->last_reading = reading;
+}
+
+static size_t begin_phase(const char *name, const void *root)
+{
+    ic->phases.push_back(PlannerPhase(name, root, charge_usage(root)));
+    return ic->phases.size() - 1;
+}
+
+static void end_phase(size_t phase)
+{
+    auto &p = ic->phases[phase];
+    auto &reading = charge_usage(p.root);
+    p.end = reading.time;
+    p.usage = reading - p.start;
+}
+
+// Paths added to an upper rel.
+static void track_upper_rel(const RelOptInfo *rel, bool partial)
+{
+    auto it = ic->upper_rels_index.find(rel);
+    if (it == ic->upper_rels_index.end())
+        return;
+
+    auto &upper = ic->upper_rels[it->second];
+
+    if (partial)
+        upper.partial_paths++;
+    else
+        upper.paths++;
+}
+
+// Partially aggregated rels are a side branch the following stage
+// consumes along with the main one.
+static bool is_partial_stage(int kind)
+{
+#if PG_VERSION_NUM >= 110000
+    return kind == UPPERREL_PARTIAL_GROUP_AGG;
+#else
+    return false;
+#endif
+}
+
+// The rel an upper rel of @kind for @relids consumes: the one for the
+// same relids at the latest earlier stage, else the scan/join rel with
+// these relids (child rels, with partitionwise aggregation) or the
+// final scan/join rel.
+// root->join_rel_hash entry, private to relnode.c.
+struct JoinRelHashEntry
+{
+    Relids      join_relids; // Hash key, must be first
+    RelOptInfo *join_rel;
+};
+
+static const void *upper_rel_input(PlannerInfo *root,
+                                   UpperRelationKind kind,
+                                   Relids relids)
+{
+    const UpperRel *input = nullptr;
+
+    for (const auto &upper: ic->upper_rels) {
+        if (upper.root != root || upper.kind >= kind
+            || is_partial_stage(upper.kind)
+            || !bms_equal(static_cast<const RelOptInfo *>(upper.rel)->relids,
+                          relids))
+            continue;
+
+        if (!input || upper.kind > input->kind)
+            input = &upper;
+    }
+
+    if (input)
+        return input->rel;
+
+    if (bms_is_empty(relids)) {
+        auto it = ic->current_rel.find(root);
+        return it != ic->current_rel.end() ? it->second : nullptr;
+    }
+
+    int relid;
+    if (bms_get_singleton_member(relids, &relid))
+        return root->simple_rel_array[relid];
+
+    // Not find_join_rel(): it builds root->join_rel_hash as it goes.
+    if (root->join_rel_hash) {
+        auto *hentry = static_cast<JoinRelHashEntry *>(
+            hash_search(root->join_rel_hash, &relids, HASH_FIND, nullptr));
+        return hentry ? hentry->join_rel : nullptr;
+    }
+
+    ListCell *lc;
+    foreach(lc, root->join_rel_list) {
+        auto *rel = static_cast<RelOptInfo *>(lfirst(lc));
+        if (bms_equal(rel->relids, relids))
+            return rel;
+    }
+    return nullptr;
+}
+
+// Criteria @winner is strictly better than @loser on.
+static std::string dominance_reason(const Path *winner, const Path *loser)
+{
+    std::string reason;
+    auto add = [&] (const char *criterion) {
+        reason += reason.empty() ? criterion : std::string(",") + criterion;
+    };
+
+    if (winner->total_cost < loser->total_cost)
+        add("total_cost");
+
+    if (winner->startup_cost < loser->startup_cost)
+        add("startup_cost");
+
+    if (compare_pathkeys(winner->pathkeys, loser->pathkeys) == PATHKEYS_BETTER1)
+        add("pathkeys");
+
+    if (bms_subset_compare(PATH_REQ_OUTER(const_cast<Path *>(winner)),
+                           PATH_REQ_OUTER(const_cast<Path *>(loser))) == BMS_SUBSET1)
+        add("parameterization");
+
+    if (winner->rows < loser->rows)
+        add("rows");
+
+    if (winner->parallel_safe && !loser->parallel_safe)
+        add("parallel_safe");
+
+    // add_path() discards near duplicates, costs compared with a fuzz
+    // factor.
+    return reason.empty() ? "fuzzy_equal" : reason;
+}
+
+// add_path()'s fuzz factor for costs, pathnode.c.
+constexpr double STD_FUZZ_FACTOR = 1.01;
+
+// compare_path_costs_fuzzily(), static in pathnode.c.
+static PathCostComparison compare_costs_fuzzily(const Path *path1,
+                                                const Path *path2,
+                                                double fuzz_factor)
+{
+    auto consider_startup = [] (const Path *path) {
+        return path->param_info ? path->parent->consider_param_startup
+                                : path->parent->consider_startup;
+    };
+
+    if (path1->total_cost > path2->total_cost * fuzz_factor) {
+        if (consider_startup(path1) &&
+            path2->startup_cost > path1->startup_cost * fuzz_factor)
+            return COSTS_DIFFERENT;
+        return COSTS_BETTER2;
+    }
+    if (path2->total_cost > path1->total_cost * fuzz_factor) {
+        if (consider_startup(path2) &&
+            path1->startup_cost > path2->startup_cost * fuzz_factor)
+            return COSTS_DIFFERENT;
+        return COSTS_BETTER1;
+    }
+    if (path1->startup_cost > path2->startup_cost * fuzz_factor)
+        return COSTS_BETTER2;
+    if (path2->startup_cost > path1->startup_cost * fuzz_factor)
+        return COSTS_BETTER1;
+    return COSTS_EQUAL;
+}
+
+enum class Verdict { KeepBoth, RemoveOld, RejectNew };
+
+// add_partial_path()'s decision on @new_path against @old_path.
+static Verdict add_partial_path_verdict(const Path *new_path,
+                                        const Path *old_path)
+{
+    const PathKeysComparison keys = compare_pathkeys(new_path->pathkeys,
+                                                     old_path->pathkeys);
+    if (keys == PATHKEYS_DIFFERENT)
+        return Verdict::KeepBoth;
+
+    if (new_path->total_cost > old_path->total_cost * STD_FUZZ_FACTOR)
+        return keys != PATHKEYS_BETTER1 ? Verdict::RejectNew
+                                        : Verdict::KeepBoth;
+
+    if (old_path->total_cost > new_path->total_cost * STD_FUZZ_FACTOR)
+        return keys != PATHKEYS_BETTER2 ? Verdict::RemoveOld
+                                        : Verdict::KeepBoth;
+
+    if (keys == PATHKEYS_BETTER1)
+        return Verdict::RemoveOld;
+    if (keys == PATHKEYS_BETTER2)
+        return Verdict::RejectNew;
+
+    return old_path->total_cost > new_path->total_cost * 1.0000000001
+           ? Verdict::RemoveOld : Verdict::RejectNew;
+}
+
+// add_path()'s decision on @new_path against @old_path, see the
+// comparisons in add_path().
+static Verdict add_path_verdict(const Path *new_path, const Path *old_path)
+{
+    const PathCostComparison costs = compare_costs_fuzzily(new_path, old_path,
+                                                           STD_FUZZ_FACTOR);
+    if (costs == COSTS_DIFFERENT)
+        return Verdict::KeepBoth;
+
+    // Parameterized paths are deemed unsorted.
+    const PathKeysComparison keys = compare_pathkeys(
+        new_path->param_info ? NIL : new_path->pathkeys,
+        old_path->param_info ? NIL : old_path->pathkeys);
+    if (keys == PATHKEYS_DIFFERENT)
+        return Verdict::KeepBoth;
+
+    const BMS_Comparison outer = bms_subset_compare(
+        PATH_REQ_OUTER(const_cast<Path *>(new_path)),
+        PATH_REQ_OUTER(const_cast<Path *>(old_path)));
+
+#if PG_VERSION_NUM >= 100000
+    const int new_safe = new_path->parallel_safe;
+    const int old_safe = old_path->parallel_safe;
+#else
+    const int new_safe = 0, old_safe = 0;
+#endif
+
+    // New one is at least as good on rows and parallel safety, and
+    // needs no more outer rels.
+    const bool new_covers = (outer == BMS_EQUAL || outer == BMS_SUBSET1) &&
+                            new_path->rows <= old_path->rows &&
+                            new_safe >= old_safe;
+    const bool old_covers = (outer == BMS_EQUAL || outer == BMS_SUBSET2) &&
+                            new_path->rows >= old_path->rows &&
+                            new_safe <= old_safe;
+
+    switch (costs) {
+    case COSTS_EQUAL:
+        if (keys == PATHKEYS_BETTER1)
+            return new_covers ? Verdict::RemoveOld : Verdict::KeepBoth;
+        if (keys == PATHKEYS_BETTER2)
+            return old_covers ? Verdict::RejectNew : Verdict::KeepBoth;
+
+        if (outer == BMS_EQUAL) {
+            if (new_safe != old_safe)
+                return new_safe > old_safe ? Verdict::RemoveOld
+                                           : Verdict::RejectNew;
+            if (new_path->rows != old_path->rows)
+                return new_path->rows < old_path->rows ? Verdict::RemoveOld
+                                                       : Verdict::RejectNew;
+            return compare_costs_fuzzily(new_path, old_path, 1.0000000001)
+                   == COSTS_BETTER1 ? Verdict::RemoveOld : Verdict::RejectNew;
+        }
+        if (outer == BMS_SUBSET1 && new_covers)
+            return Verdict::RemoveOld;
+        if (outer == BMS_SUBSET2 && old_covers)
+            return Verdict::RejectNew;
+        return Verdict::KeepBoth;
+
+    case COSTS_BETTER1:
+        return keys != PATHKEYS_BETTER2 && new_covers ? Verdict::RemoveOld
+                                                      : Verdict::KeepBoth;
+    case COSTS_BETTER2:
+        return keys != PATHKEYS_BETTER1 && old_covers ? Verdict::RejectNew
+                                                      : Verdict::KeepBoth;
+    default:
+        return Verdict::KeepBoth;
+    }
+}
+
+static Verdict path_verdict(const Path *new_path, const Path *old_path,
+                            bool partial)
+{
+    return partial ? add_partial_path_verdict(new_path, old_path)
+                   : add_path_verdict(new_path, old_path);
+}
+
+static const void *sample_id(const void *p)
+{
+    auto it = ic->samples_index.find(p);
+    return it != ic->samples_index.end() ? ic->samples[it->second].id : p;
+}
+
+// Diff the path list around add_path(): evicted paths were killed by
+// the new one, a rejected new path was killed by a survivor.
+static void record_dominance(const List *pathlist,
+                             const std::vector<Path *> &pathlist_before,
+                             Path *new_path, const void *new_id,
+                             bool partial)
+{
+    for (auto *old_path: pathlist_before) {
+        if (list_member_ptr(pathlist, old_path))
+            continue;
+
+        const bool agreed = path_verdict(new_path, old_path, partial)
+                            == Verdict::RemoveOld;
+        ic->dominance.push_back(DominanceEdge(
+            new_id, sample_id(old_path), "evicted",
+            agreed ? dominance_reason(new_path, old_path) : "unknown",
+            partial));
+    }
+
+    if (list_member_ptr(pathlist, new_path))
+        return;
+
+    // Survivors are compared in list order, as add_path() does.
+    // Rejected paths are kept alive by pfree hook.
+    ListCell *lc;
+
+    foreach(lc, pathlist) {
+        auto *path = reinterpret_cast<const Path *>(lfirst(lc));
+
+        if (path_verdict(new_path, path, partial) == Verdict::RejectNew) {
+            ic->dominance.push_back(DominanceEdge(
+                sample_id(path), new_id, "rejected",
+                dominance_reason(path, new_path), partial));
+            return;
+        }
+    }
+
+    // Our replica of add_path() logic came up empty.
+    ic->dominance.push_back(DominanceEdge(nullptr, new_id, "rejected",
+                                          "unknown", partial));
+}
+
+static std::vector<Path *> pathlist_copy(const List *pathlist)
+{
+    std::vector<Path *> res;
+    ListCell *lc;
+
+    foreach(lc, pathlist)
+        res.push_back(reinterpret_cast<Path *>(lfirst(lc)));
+
+    return res;
+}
+
+// Cost functions run before a path is added, hence breakdowns are
+// kept aside until then. Some are computed for throwaway Paths on the
+// stack, those never get attached.
+static void record_costs(const void *path, const char *function,
+                         std::initializer_list<std::pair<const char *, double>> items)
+{
+    std::ostringstream os;
+
+    os << "{\"function\":\"" << function << '"';
+    for (const auto &item: items)
+        os << ",\"" << item.first << "\":" << item.second;
+    os << '}';
+
+    ic->pending_costs[path] = os.str();
+}
+
+static void attach_costs(PgObject &desc, const void *path)
+{
+    auto it = ic->pending_costs.find(path);
+    if (it == ic->pending_costs.end())
+        return;
+
+    desc.costs = std::move(it->second);
+    ic->pending_costs.erase(it);
+}
+
 void __wrap__add_path(RelOptInfo *parent_rel, Path *new_path)
 {
-    if (ic) {
-        capture_object(parent_rel);
-        capture_backtrace(capture_proxy(new_path), 1).parent = parent_rel;
+    dispatch_event(PLANSCAPE_EVENT_ADD_PATH, nullptr, parent_rel, new_path,
+                   nullptr);
+
+    if (planning_counters)
+        planning_counters->paths++;
+
+    if (!recording_objects())
+        return __real__add_path(parent_rel, new_path);
+
+    track_upper_rel(parent_rel, false);
+    charge_usage(parent_rel);
+    capture_object(parent_rel);
+    auto &desc = capture_event(capture_backtrace(capture_proxy(new_path), 1),
+                               "add_path");
+    desc.parent = parent_rel;
+    attach_costs(desc, new_path);
+
+    if (!ic->dominance_enabled) {
+        exclude_capture();
+        return __real__add_path(parent_rel, new_path);
     }
 
-    return __real__add_path(parent_rel, new_path);
+    const void *new_id = desc.id;
+    auto pathlist_before = pathlist_copy(parent_rel->pathlist);
+    exclude_capture();
+    __real__add_path(parent_rel, new_path);
+    charge_usage(parent_rel);
+    record_dominance(parent_rel->pathlist, pathlist_before,
+                     new_path, new_id, false);
+    exclude_capture();
 }
 
 void __wrap__add_partial_path(RelOptInfo *parent_rel, Path *new_path)
 {
-    if (ic) {
-        capture_object(parent_rel);
-        capture_backtrace(capture_proxy(new_path), 1).parent = parent_rel;
+    dispatch_event(PLANSCAPE_EVENT_ADD_PARTIAL_PATH, nullptr, parent_rel,
+                   new_path, nullptr);
+
+    if (planning_counters)
+        planning_counters->paths++;
+
+    if (!recording_objects())
+        return __real__add_partial_path(parent_rel, new_path);
+
+    track_upper_rel(parent_rel, true);
+    charge_usage(parent_rel);
+    capture_object(parent_rel);
+    auto &desc = capture_event(capture_backtrace(capture_proxy(new_path), 1),
+                               "add_partial_path");
+    desc.parent = parent_rel;
+    attach_costs(desc, new_path);
+
+    if (!ic->dominance_enabled) {
+        exclude_capture();
+        return __real__add_partial_path(parent_rel, new_path);
     }
 
-    return __real__add_partial_path(parent_rel, new_path);
+    const void *new_id = desc.id;
+    auto pathlist_before = pathlist_copy(parent_rel->partial_pathlist);
+    exclude_capture();
+    __real__add_partial_path(parent_rel, new_path);
+    charge_usage(parent_rel);
+    record_dominance(parent_rel->partial_pathlist, pathlist_before,
+                     new_path, new_id, true);
+    exclude_capture();
 }
 
 RelOptInfo *__wrap__build_simple_rel(PlannerInfo *root,
@@ -239,11 +787,21 @@ RelOptInfo *__wrap__build_simple_rel(PlannerInfo *root,
     if (!ic)
         return __real__build_simple_rel(root, relid, param3);
 
+    // Catalog access in get_relation_info() is the relation's.
+    const Oid catalog_relation_prev = ic->catalog_relation;
+    ic->catalog_relation = root->simple_rte_array[relid]->relid;
     auto p = __real__build_simple_rel(root, relid, param3);
+    ic->catalog_relation = catalog_relation_prev;
+
+    charge_usage(p);
     capture_object(root);
-    auto &relinfo = capture_object(p);
+    auto &relinfo = capture_event(capture_object(p), "build_simple_rel");
     relinfo.parent = root;
     relinfo.oid = root->simple_rte_array[relid]->relid;
+#if PG_VERSION_NUM >= 100000
+    relinfo.appendrel = param3;
+#endif
+    exclude_capture();
     return p;
 }
 
@@ -256,148 +814,1802 @@ RelOptInfo * __wrap__build_empty_join_rel(PlannerInfo *root)
         return __real__build_empty_join_rel(root);
 
     auto p = __real__build_empty_join_rel(root);
+    charge_usage(p);
     capture_object(root);
-    capture_object(p).parent = root;
+    capture_event(capture_object(p), "build_empty_join_rel").parent = root;
+    exclude_capture();
     return p;
 }
 
-Plan *__wrap__create_plan(PlannerInfo *root, Path *best_path)
+RelOptInfo *__wrap__fetch_upper_rel(PlannerInfo *root,
+                                    UpperRelationKind kind,
+                                    Relids relids)
 {
-    if (ic)
-        capture_object(best_path).isChosen = true;
+    if (!ic)
+        return __real__fetch_upper_rel(root, kind, relids);
+
+    auto rel = __real__fetch_upper_rel(root, kind, relids);
+
+    // Called to both create and look up the rel.
+    auto ins = ic->upper_rels_index.emplace(rel, ic->upper_rels.size());
+    if (ins.second) {
+        ic->upper_rels.push_back(UpperRel(rel, root, kind));
+        ic->upper_rels.back().input = upper_rel_input(root, kind, relids);
+        charge_usage(rel);
+        capture_object(root);
+        capture_event(capture_object(rel), "fetch_upper_rel").parent = root;
+        exclude_capture();
+    }
 
-    return __real__create_plan(root, best_path);
+    return rel;
 }
 
-static std::string submit_report()
+// Relids as a hex bitmap, bit N is RT index N.
+static std::string format_relids(Relids relids)
 {
-    char path_buf[] = "/tmp/XXXXXX";
-    std::ostringstream os;
-    make_report(os, *ic);
-    auto report_data = os.str();
-    int fd = mkstemp(path_buf);
-    write(fd, report_data.c_str(), report_data.size()); 
-    fchmod(fd, 0604);
-    close(fd);
-    return path_buf;
+    std::vector<uint64_t> words;
+    int member = -1;
+
+    while ((member = bms_next_member(relids, member)) >= 0) {
+        if (words.size() <= size_t(member / 64))
+            words.resize(member / 64 + 1);
+        words[member / 64] |= uint64_t(1) << (member % 64);
+    }
+
+    if (words.empty())
+        return "0x0";
+
+    char buf[24];
+    std::string res;
+
+    snprintf(buf, sizeof buf, "0x%" PRIx64, words.back());
+    res = buf;
+    for (size_t i = words.size() - 1; i-- > 0; ) {
+        snprintf(buf, sizeof buf, "%016" PRIx64, words[i]);
+        res += buf;
+    }
+
+    return res;
 }
 
-void __wrap__ExplainPrintPlan(ExplainState *es, QueryDesc *queryDesc)
+RelOptInfo *__wrap__build_join_rel(PlannerInfo *root,
+                                   Relids joinrelids,
+                                   RelOptInfo *outer_rel,
+                                   RelOptInfo *inner_rel,
+                                   SpecialJoinInfo *sjinfo,
+                                   List **restrictlist_ptr)
 {
-    if (!ic)
-        return __real__ExplainPrintPlan(es, queryDesc);
+    if (!ic && !planning_counters)
+        return __real__build_join_rel(root, joinrelids, outer_rel, inner_rel,
+                                      sjinfo, restrictlist_ptr);
+
+    const int join_rels_before = list_length(root->join_rel_list);
+    auto rel = __real__build_join_rel(root, joinrelids, outer_rel, inner_rel,
+                                      sjinfo, restrictlist_ptr);
+
+    if (planning_counters)
+        planning_counters->join_rels +=
+            list_length(root->join_rel_list) > join_rels_before;
+
+    if (!recording_objects())
+        return rel;
+
+    charge_usage(rel);
+
+    // Called for every pair joined, the rel is built on the first call.
+    auto ins = ic->join_rels_index.emplace(rel, ic->join_rels.size());
+    if (ins.second) {
+        ic->join_rels.push_back(JoinRel(rel, root, format_relids(joinrelids),
+                                        bms_num_members(joinrelids)));
+        if (ic->join_level != SIZE_MAX)
+            ic->join_levels[ic->join_level].rels_built++;
+    }
+    ic->join_rels[ins.first->second].pairs++;
 
-    __real__ExplainPrintPlan(es, queryDesc);
+    exclude_capture();
+    return rel;
+}
 
-    std::string url = submit_report();
-    clear_instrumentation_context(*ic);
+RelOptInfo *__wrap__make_join_rel(PlannerInfo *root,
+                                  RelOptInfo *rel1, RelOptInfo *rel2)
+{
+    if (recording_objects() && ic->join_level != SIZE_MAX)
+        ic->join_levels[ic->join_level].pairs_tried++;
 
-    if (es->format == EXPLAIN_FORMAT_TEXT)
-        appendStringInfo(es->str, "Planscape URL: %s\n", url.c_str());
-    else
-        ExplainPropertyText("Planscape URL", url.c_str(), es);;
+    return __real__make_join_rel(root, rel1, rel2);
 }
 
-static Node *remove_planscape_options_from_explain_stmt(Node *parsetree,
-                                                        bool *enable_planscape)
+void __wrap__join_search_one_level(PlannerInfo *root, int level)
 {
-    assert(IsA(parsetree, ExplainStmt));
-    *enable_planscape = false;
+    if (!ic)
+        return __real__join_search_one_level(root, level);
 
-    auto *explain = reinterpret_cast<ExplainStmt *>(parsetree);
-    auto *explain_copy = makeNode(ExplainStmt);
+    const size_t join_level_prev = ic->join_level;
+    size_t phase = begin_phase("join_search_one_level", root);
 
-    // Scan list for 'planscape' option.
-    // Produce a copy of options list, removing 'planscape' options.
-    ListCell *lc;
-    foreach(lc, explain->options) {
-        assert(IsA(lfirst(lc), DefElem));
-        auto *opt = reinterpret_cast<DefElem *>(lfirst(lc));
-        if (strcmp(opt->defname, "planscape") == 0) {
-            *enable_planscape = defGetBoolean(opt);
-        } else {
-            explain_copy->options = lappend(explain_copy->options, opt);
-        }
-    }
+    ic->join_levels.push_back(JoinLevel(root, level, phase));
+    ic->join_level = ic->join_levels.size() - 1;
 
-    explain_copy->query = explain->query;
-    return reinterpret_cast<Node *>(explain_copy);
-}
+    __real__join_search_one_level(root, level);
 
-#if PG_VERSION_NUM >= 100000
-#define QUERY_ENVIRONMENT_PARAM(arg, _) arg,
-#else
-#define QUERY_ENVIRONMENT_PARAM(arg, _)
-#endif
+    ic->join_level = join_level_prev;
+    end_phase(phase);
+}
 
-static void process_utility(
-#if PG_VERSION_NUM >= 100000
-                            PlannedStmt *parsetree,
-#else
-                            Node *parsetree,
-#endif
-                            const char *queryString,
-                            ProcessUtilityContext context,
-                            ParamListInfo paramListInfo,
-    QUERY_ENVIRONMENT_PARAM(QueryEnvironment *queryEnvironment,)
-                            DestReceiver *destReceiver,
-                            char *completionTag)
+RelOptInfo *__wrap__geqo(PlannerInfo *root, int number_of_rels,
+                         List *initial_rels)
 {
-    bool enable_planscape;
+    if (!ic)
+        return __real__geqo(root, number_of_rels, initial_rels);
 
-#if PG_VERSION_NUM >= 100000
-    if (IsA(parsetree->utilityStmt, ExplainStmt)) {
+    const size_t geqo_run_prev = ic->geqo_run;
+    size_t phase = begin_phase("geqo", root);
 
-        parsetree->utilityStmt = remove_planscape_options_from_explain_stmt(
-                parsetree->utilityStmt, &enable_planscape);
-#else
-    if (IsA(parsetree, ExplainStmt)) {
+    ic->geqo_runs.push_back(GeqoRun(root, number_of_rels));
+    ic->geqo_runs.back().generations.push_back(
+        GeqoGeneration(ic->phases[phase].begin));
+    ic->geqo_run = ic->geqo_runs.size() - 1;
 
-        parsetree = remove_planscape_options_from_explain_stmt(
-                parsetree, &enable_planscape);
+    auto rel = __real__geqo(root, number_of_rels, initial_rels);
 
-#endif
-        // Create new IC
-        std::unique_ptr<InstrumentationContext> icontext;
+    // The final tour is built after the last generation is closed.
+    auto &generations = ic->geqo_runs[ic->geqo_run].generations;
+    if (generations.back().evaluated == 0)
+        generations.pop_back();
 
-        if (enable_planscape) {
+    ic->geqo_run = geqo_run_prev;
+    end_phase(phase);
+    return rel;
+}
 
-            if (!install_hooks()) {
-                ereport(ERROR,
-                        (errcode(ERRCODE_SYSTEM_ERROR),
-                errmsg("failed to install PLANSCAPE hooks"),
-                errhint("%s", hook_last_error())));
-            }
+Cost __wrap__geqo_eval(PlannerInfo *root, Gene *tour, int num_gene)
+{
+    if (!ic || ic->geqo_run == SIZE_MAX)
+        return __real__geqo_eval(root, tour, num_gene);
+
+    Cost fitness;
+
+    if (ic->geqo_summarize) {
+        // Candidate join trees are built in a short-lived memory context
+        // and thrown away; capturing them would pin memory and recycle
+        // identities. Record no objects for the duration, accounting
+        // (catalogs, locks, usage) goes on.
+        ic->geqo_candidate = true;
+        fitness = __real__geqo_eval(root, tour, num_gene);
+        ic->geqo_candidate = false;
+    } else {
+        fitness = __real__geqo_eval(root, tour, num_gene);
+    }
 
-            icontext = create_instrumentation_context();
-        }
+    charge_usage(root);
 
-        auto * const ic_prev = ic;
+    auto &generation = ic->geqo_runs[ic->geqo_run].generations.back();
+    if (generation.evaluated++ == 0) {
+        generation.best = generation.worst = fitness;
+    } else {
+        generation.best = std::min(generation.best, fitness);
+        generation.worst = std::max(generation.worst, fitness);
+    }
 
-        PG_TRY();
-        {
-            ic = icontext.get();
+    return fitness;
+}
 
-            process_utility_hook_next(parsetree,
-                                      queryString,
-                                      context,
-                                      paramListInfo,
-              QUERY_ENVIRONMENT_PARAM(queryEnvironment,)
-                                      destReceiver,
-                                      completionTag);
+static void end_geqo_generation(PlannerInfo *root, Pool *pool)
+{
+    if (!ic || ic->geqo_run == SIZE_MAX)
+        return;
 
-            ic = ic_prev;
-        }
-        PG_CATCH();
-        {
-            ic = ic_prev;
+    auto &generations = ic->geqo_runs[ic->geqo_run].generations;
+    auto &generation = generations.back();
+    const uint64_t end = charge_usage(root).time;
 
-            // NB: explicit destruction needed; PG_RE_THROW() is a
-            // longjump in disguise.
-            icontext.reset();
+    // Pool is sorted, the best chromosome first.
+    generation.end = end;
+    generation.pool_best = pool->data[0].worth;
+    generation.pool_worst = pool->data[pool->size - 1].worth;
 
-            PG_RE_THROW();
-        }
+    generations.push_back(GeqoGeneration(end));
+}
+
+void __wrap__spread_chromo(PlannerInfo *root, Chromosome *chromo, Pool *pool)
+{
+    __real__spread_chromo(root, chromo, pool);
+    end_geqo_generation(root, pool);
+}
+
+void __wrap__sort_pool(PlannerInfo *root, Pool *pool)
+{
+    __real__sort_pool(root, pool);
+    end_geqo_generation(root, pool);
+}
+
+Selectivity __wrap__clause_selectivity(PlannerInfo *root, Node *clause,
+                                       int varRelid, JoinType jointype,
+                                       SpecialJoinInfo *sjinfo)
+{
+    // Nested calls (AND/OR arguments) are part of the outer estimate.
+    if (!recording_objects() || ic->clause_estimate != SIZE_MAX)
+        return __real__clause_selectivity(root, clause, varRelid, jointype,
+                                          sjinfo);
+
+    // Estimates outside set_*_size_estimates() belong to the query.
+    const void *owner = ic->estimating_rel ? ic->estimating_rel : root;
+    charge_usage(owner);
+
+    auto ins = ic->clause_estimates_index.emplace(
+        std::make_tuple(clause, varRelid, int(jointype)),
+        ic->clause_estimates.size());
+
+    if (ins.second) {
+        ic->clause_estimates.push_back(ClauseEstimate(
+            capture_object(clause).id, ic->estimating_rel, varRelid, jointype));
+    }
+
+    ic->clause_estimate = ins.first->second;
+    exclude_capture();
+
+    const uint64_t begin = capture_timestamp();
+    auto selectivity = __real__clause_selectivity(root, clause, varRelid,
+                                                  jointype, sjinfo);
+    const uint64_t end = capture_timestamp();
+
+    charge_usage(owner);
+    auto &estimate = ic->clause_estimates[ic->clause_estimate];
+
+    estimate.time += end - begin;
+    estimate.calls++;
+    estimate.selectivity = selectivity;
+
+    ic->clause_estimate = SIZE_MAX;
+    exclude_capture();
+    return selectivity;
+}
+
+Selectivity __wrap__clauselist_selectivity(PlannerInfo *root, List *clauses,
+                                           int varRelid, JoinType jointype,
+                                           SpecialJoinInfo *sjinfo)
+{
+    if (!ic || ic->clause_estimate != SIZE_MAX)
+        return __real__clauselist_selectivity(root, clauses, varRelid,
+                                              jointype, sjinfo);
+
+    const uint64_t begin = capture_timestamp();
+    auto selectivity = __real__clauselist_selectivity(root, clauses, varRelid,
+                                                      jointype, sjinfo);
+
+    ic->clauselist_time += capture_timestamp() - begin;
+    ic->clauselist_calls++;
+    return selectivity;
+}
+
+void __wrap__set_baserel_size_estimates(PlannerInfo *root, RelOptInfo *rel)
+{
+    if (!ic)
+        return __real__set_baserel_size_estimates(root, rel);
+
+    auto * const estimating_rel_prev = ic->estimating_rel;
+    const uint64_t begin = capture_timestamp();
+
+    const Oid catalog_relation_prev = ic->catalog_relation;
+
+    ic->estimating_rel = rel;
+    ic->catalog_relation = root->simple_rte_array[rel->relid]->relid;
+    __real__set_baserel_size_estimates(root, rel);
+    ic->estimating_rel = estimating_rel_prev;
+    ic->catalog_relation = catalog_relation_prev;
+
+    ic->rel_estimates.push_back(RelEstimate(rel, rel->rows,
+                                            capture_timestamp() - begin));
+}
+
+void __wrap__set_joinrel_size_estimates(PlannerInfo *root, RelOptInfo *rel,
+                                        RelOptInfo *outer_rel,
+                                        RelOptInfo *inner_rel,
+                                        SpecialJoinInfo *sjinfo,
+                                        List *restrictlist)
+{
+    if (!recording_objects())
+        return __real__set_joinrel_size_estimates(root, rel, outer_rel,
+                                                  inner_rel, sjinfo,
+                                                  restrictlist);
+
+    auto * const estimating_rel_prev = ic->estimating_rel;
+    const uint64_t begin = capture_timestamp();
+
+    ic->estimating_rel = rel;
+    __real__set_joinrel_size_estimates(root, rel, outer_rel, inner_rel,
+                                       sjinfo, restrictlist);
+    ic->estimating_rel = estimating_rel_prev;
+
+    ic->rel_estimates.push_back(RelEstimate(rel, rel->rows,
+                                            capture_timestamp() - begin));
+}
+
+static void note_stats_source(unsigned source)
+{
+    if (ic && ic->clause_estimate != SIZE_MAX)
+        ic->clause_estimates[ic->clause_estimate].sources |= source;
+}
+
+static unsigned stats_slot_source(int reqkind)
+{
+    switch (reqkind) {
+    case STATISTIC_KIND_MCV:       return STATS_SOURCE_MCV;
+    case STATISTIC_KIND_HISTOGRAM: return STATS_SOURCE_HISTOGRAM;
+    default:                       return STATS_SOURCE_OTHER;
+    }
+}
+
+#if PG_VERSION_NUM >= 100000
+bool __wrap__get_attstatsslot(AttStatsSlot *sslot, HeapTuple statstuple,
+                              int reqkind, Oid reqop, int flags)
+{
+    bool found = __real__get_attstatsslot(sslot, statstuple, reqkind,
+                                          reqop, flags);
+    if (found)
+        note_stats_source(stats_slot_source(reqkind));
+
+    return found;
+}
+#else
+bool __wrap__get_attstatsslot(HeapTuple statstuple,
+                              Oid atttype, int32 atttypmod,
+                              int reqkind, Oid reqop,
+                              Oid *actualop,
+                              Datum **values, int *nvalues,
+                              float4 **numbers, int *nnumbers)
+{
+    bool found = __real__get_attstatsslot(statstuple, atttype, atttypmod,
+                                          reqkind, reqop, actualop,
+                                          values, nvalues, numbers, nnumbers);
+    if (found)
+        note_stats_source(stats_slot_source(reqkind));
+
+    return found;
+}
+#endif
+
+double __wrap__get_variable_numdistinct(VariableStatData *vardata,
+                                        bool *isdefault)
+{
+    double ndistinct = __real__get_variable_numdistinct(vardata, isdefault);
+
+    note_stats_source(*isdefault ? STATS_SOURCE_DEFAULT
+                                 : STATS_SOURCE_NDISTINCT);
+    return ndistinct;
+}
+
+void __wrap__cost_seqscan(Path *path, PlannerInfo *root,
+                          RelOptInfo *baserel, ParamPathInfo *param_info)
+{
+    __real__cost_seqscan(path, root, baserel, param_info);
+
+    if (!recording_objects())
+        return;
+
+    double spc_seq_page_cost;
+    get_tablespace_page_costs(baserel->reltablespace, nullptr,
+                              &spc_seq_page_cost);
+
+    const double qual_per_tuple = baserel->baserestrictcost.per_tuple;
+    const double cpu_per_tuple = cpu_tuple_cost + qual_per_tuple;
+
+    // Parallel workers divide CPU cost, not I/O.
+    record_costs(path, "cost_seqscan", {
+        {"pages",             baserel->pages},
+        {"seqPageCost",       spc_seq_page_cost},
+        {"ioCost",            spc_seq_page_cost * baserel->pages},
+        {"tuples",            baserel->tuples},
+        {"cpuPerTuple",       cpu_per_tuple},
+        {"qualPerTuple",      qual_per_tuple},
+        {"cpuCost",           cpu_per_tuple * baserel->tuples},
+        {"parallelWorkers",   path->parallel_workers},
+    });
+}
+
+void __wrap__cost_index(IndexPath *path, PlannerInfo *root,
+                        COST_INDEX_PARAMS)
+{
+    __real__cost_index(path, root, COST_INDEX_ARGS);
+
+    if (!recording_objects())
+        return;
+
+    const auto *index = path->indexinfo;
+    const auto *baserel = index->rel;
+    double spc_random_page_cost, spc_seq_page_cost;
+
+    get_tablespace_page_costs(baserel->reltablespace,
+                              &spc_random_page_cost, &spc_seq_page_cost);
+
+    // Heap I/O bounds cost_index() interpolates between by index
+    // correlation: every tuple on a random page vs. sequential pages.
+    const double tuples_fetched = clamp_row_est(path->indexselectivity *
+                                                baserel->tuples);
+    const double max_pages = index_pages_fetched(tuples_fetched,
+                                                 baserel->pages,
+                                                 (double) index->pages,
+                                                 root);
+    const double min_pages = ceil(path->indexselectivity * baserel->pages);
+    const double qual_per_tuple = baserel->baserestrictcost.per_tuple;
+
+    record_costs(path, "cost_index", {
+        {"indexCost",         path->indextotalcost},
+        {"indexSelectivity",  path->indexselectivity},
+        {"tuplesFetched",     tuples_fetched},
+        {"heapPagesMax",      max_pages},
+        {"heapPagesMin",      min_pages},
+        {"randomPageCost",    spc_random_page_cost},
+        {"seqPageCost",       spc_seq_page_cost},
+        {"maxIOCost",         max_pages * spc_random_page_cost},
+        {"minIOCost",         min_pages > 0 ? spc_random_page_cost +
+                                (min_pages - 1) * spc_seq_page_cost : 0},
+        {"cpuPerTuple",       cpu_tuple_cost + qual_per_tuple},
+        {"qualPerTuple",      qual_per_tuple},
+        {"loopCount",         loop_count},
+    });
+}
+
+void __wrap__cost_bitmap_heap_scan(Path *path, PlannerInfo *root,
+                                   RelOptInfo *baserel,
+                                   ParamPathInfo *param_info,
+                                   Path *bitmapqual, double loop_count)
+{
+    __real__cost_bitmap_heap_scan(path, root, baserel, param_info,
+                                  bitmapqual, loop_count);
+
+    if (!recording_objects())
+        return;
+
+    Cost index_cost;
+    Selectivity index_selectivity;
+    double spc_random_page_cost, spc_seq_page_cost;
+
+    cost_bitmap_tree_node(bitmapqual, &index_cost, &index_selectivity);
+    get_tablespace_page_costs(baserel->reltablespace,
+                              &spc_random_page_cost, &spc_seq_page_cost);
+
+    // Mackert-Lohman estimate of heap pages fetched for a single scan,
+    // page cost slides from random to sequential as more pages are read.
+    const double T = baserel->pages > 1 ? baserel->pages : 1;
+    const double tuples_fetched = clamp_row_est(index_selectivity *
+                                                baserel->tuples);
+    double pages_fetched = 2.0 * T * tuples_fetched / (2.0 * T + tuples_fetched);
+    pages_fetched = pages_fetched >= T ? T : ceil(pages_fetched);
+
+    const double cost_per_page = pages_fetched >= 2.0
+        ? spc_random_page_cost - (spc_random_page_cost - spc_seq_page_cost) *
+                                 sqrt(pages_fetched / T)
+        : spc_random_page_cost;
+    const double qual_per_tuple = baserel->baserestrictcost.per_tuple;
+
+    record_costs(path, "cost_bitmap_heap_scan", {
+        {"indexCost",         index_cost},
+        {"indexSelectivity",  index_selectivity},
+        {"tuplesFetched",     tuples_fetched},
+        {"heapPages",         pages_fetched},
+        {"costPerPage",       cost_per_page},
+        {"ioCost",            pages_fetched * cost_per_page},
+        {"cpuPerTuple",       cpu_tuple_cost + qual_per_tuple},
+        {"qualPerTuple",      qual_per_tuple},
+        {"loopCount",         loop_count},
+    });
+}
+
+// Final costing adds qual evaluation and per output tuple CPU to the
+// initial estimate in workspace.
+void __wrap__final_cost_nestloop(PlannerInfo *root, NestPath *path,
+                                 JoinCostWorkspace *workspace,
+                                 FINAL_COST_PARAMS)
+{
+    __real__final_cost_nestloop(root, path, workspace, FINAL_COST_ARGS);
+
+    if (!recording_objects())
+        return;
+
+    record_costs(path, "final_cost_nestloop", {
+        {"outerRows",         workspace->outer_rows},
+        {"innerRows",         workspace->inner_rows},
+        {"initialCost",       workspace->total_cost},
+        {"runCost",           workspace->run_cost},
+        {"innerRescanRunCost", workspace->inner_rescan_run_cost},
+        {"qualAndCpuCost",    path->path.total_cost - workspace->total_cost},
+    });
+}
+
+void __wrap__final_cost_mergejoin(PlannerInfo *root, MergePath *path,
+                                  JoinCostWorkspace *workspace,
+                                  FINAL_COST_PARAMS)
+{
+    __real__final_cost_mergejoin(root, path, workspace, FINAL_COST_ARGS);
+
+    if (!recording_objects())
+        return;
+
+    record_costs(path, "final_cost_mergejoin", {
+        {"outerRows",         workspace->outer_rows},
+        {"innerRows",         workspace->inner_rows},
+        {"outerSkipRows",     workspace->outer_skip_rows},
+        {"innerSkipRows",     workspace->inner_skip_rows},
+        {"outerSort",         path->outersortkeys != NIL},
+        {"innerSort",         path->innersortkeys != NIL},
+        {"materializeInner",  path->materialize_inner},
+        {"initialCost",       workspace->total_cost},
+        {"innerRunCost",      workspace->inner_run_cost},
+        {"qualAndCpuCost",    path->jpath.path.total_cost - workspace->total_cost},
+    });
+}
+
+void __wrap__final_cost_hashjoin(PlannerInfo *root, HashPath *path,
+                                 JoinCostWorkspace *workspace,
+                                 FINAL_COST_PARAMS)
+{
+    __real__final_cost_hashjoin(root, path, workspace, FINAL_COST_ARGS);
+
+    if (!recording_objects())
+        return;
+
+    const double inner_bytes = workspace->inner_rows *
+        path->jpath.innerjoinpath->pathtarget->width;
+
+    // More than one batch means the inner side spills to disk.
+    record_costs(path, "final_cost_hashjoin", {
+        {"outerRows",         workspace->outer_rows},
+        {"innerRows",         workspace->inner_rows},
+        {"innerBytes",        inner_bytes},
+        {"workMemBytes",      work_mem * 1024.0},
+        {"buckets",           workspace->numbuckets},
+        {"batches",           workspace->numbatches},
+        {"spill",             workspace->numbatches > 1},
+        {"initialCost",       workspace->total_cost},
+        {"qualAndCpuCost",    path->jpath.path.total_cost - workspace->total_cost},
+    });
+}
+
+void __wrap__cost_sort(Path *path, PlannerInfo *root,
+                       List *pathkeys, Cost input_cost, double tuples,
+                       int width, Cost comparison_cost,
+                       int sort_mem, double limit_tuples)
+{
+    __real__cost_sort(path, root, pathkeys, input_cost, tuples, width,
+                      comparison_cost, sort_mem, limit_tuples);
+
+    if (!recording_objects())
+        return;
+
+    // Same as relation_byte_size().
+    const double input_bytes = clamp_row_est(tuples) *
+        (MAXALIGN(width) + MAXALIGN(SizeofHeapTupleHeader));
+    const double sort_mem_bytes = sort_mem * 1024.0;
+
+    record_costs(path, "cost_sort", {
+        {"tuples",            tuples},
+        {"width",             width},
+        {"inputCost",         input_cost},
+        {"comparisonCost",    2.0 * cpu_operator_cost + comparison_cost},
+        {"inputBytes",        input_bytes},
+        {"sortMemBytes",      sort_mem_bytes},
+        {"spill",             input_bytes > sort_mem_bytes},
+        {"limitTuples",       limit_tuples},
+    });
+}
+
+void __wrap__cost_agg(Path *path, PlannerInfo *root,
+                      AggStrategy aggstrategy,
+                      const AggClauseCosts *aggcosts,
+                      int numGroupCols, double numGroups,
+                      Cost input_startup_cost, Cost input_total_cost,
+                      double input_tuples)
+{
+    __real__cost_agg(path, root, aggstrategy, aggcosts, numGroupCols,
+                     numGroups, input_startup_cost, input_total_cost,
+                     input_tuples);
+
+    if (!recording_objects())
+        return;
+
+    record_costs(path, "cost_agg", {
+        {"strategy",          aggstrategy},
+        {"groupCols",         numGroupCols},
+        {"groups",            numGroups},
+        {"inputTuples",       input_tuples},
+        {"inputCost",         input_total_cost},
+        {"transPerTuple",     aggcosts ? aggcosts->transCost.per_tuple : 0},
+        {"finalPerGroup",     aggcosts ? aggcosts->finalCost : 0},
+        {"transitionSpace",   aggcosts ? aggcosts->transitionSpace : 0},
+    });
+}
+
+// Catalog access and locking are only tracked during planning, report
+// generation does plenty of its own.
+static bool capturing_planning()
+{
+    return ic && planner_depth > 0;
+}
+
+static void note_catalog_access(CatalogAccess &access, bool miss,
+                                uint64_t begin)
+{
+    auto &relation = ic->catalog_by_relation[ic->catalog_relation];
+
+    access.lookups++;
+    access.misses += miss;
+    relation.lookups++;
+    relation.misses += miss;
+
+    // Nested lookups are part of the outer one's time.
+    if (ic->catalog_depth == 0) {
+        const uint64_t time = capture_timestamp() - begin;
+        access.time += time;
+        relation.time += time;
+    }
+}
+
+// A miss adds a (possibly negative) entry to the cache.
+template<typename Search>
+static HeapTuple search_catcache(CatCache *cache, Search search)
+{
+    if (!capturing_planning())
+        return search();
+
+    const int ntup = cache->cc_ntup;
+    const uint64_t begin = capture_timestamp();
+
+    ic->catalog_depth++;
+    HeapTuple tuple = search();
+    ic->catalog_depth--;
+
+    auto &syscache = ic->syscaches[cache->id];
+    syscache.catalog = cache->cc_relname;
+    note_catalog_access(syscache.access, cache->cc_ntup > ntup, begin);
+    return tuple;
+}
+
+HeapTuple __wrap__SearchCatCache(CatCache *cache,
+                                 Datum v1, Datum v2, Datum v3, Datum v4)
+{
+    return search_catcache(cache, [=] {
+        return __real__SearchCatCache(cache, v1, v2, v3, v4);
+    });
+}
+
+#if PG_VERSION_NUM >= 110000
+HeapTuple __wrap__SearchCatCache1(CatCache *cache, Datum v1)
+{
+    return search_catcache(cache, [=] {
+        return __real__SearchCatCache1(cache, v1);
+    });
+}
+
+HeapTuple __wrap__SearchCatCache2(CatCache *cache, Datum v1, Datum v2)
+{
+    return search_catcache(cache, [=] {
+        return __real__SearchCatCache2(cache, v1, v2);
+    });
+}
+
+HeapTuple __wrap__SearchCatCache3(CatCache *cache,
+                                  Datum v1, Datum v2, Datum v3)
+{
+    return search_catcache(cache, [=] {
+        return __real__SearchCatCache3(cache, v1, v2, v3);
+    });
+}
+
+HeapTuple __wrap__SearchCatCache4(CatCache *cache,
+                                  Datum v1, Datum v2, Datum v3, Datum v4)
+{
+    return search_catcache(cache, [=] {
+        return __real__SearchCatCache4(cache, v1, v2, v3, v4);
+    });
+}
+#endif
+
+// Relcache hash is private to relcache.c. A miss builds the entry
+// with RelationBuildDesc(), which starts off scanning pg_class.
+Relation __wrap__RelationIdGetRelation(Oid relationId)
+{
+    if (!capturing_planning())
+        return __real__RelationIdGetRelation(relationId);
+
+    const size_t scans = ic->catalog_scans_total;
+    const uint64_t begin = capture_timestamp();
+
+    ic->catalog_depth++;
+    Relation relation = __real__RelationIdGetRelation(relationId);
+    ic->catalog_depth--;
+
+    note_catalog_access(ic->relcache, ic->catalog_scans_total > scans, begin);
+    return relation;
+}
+
+SysScanDesc __wrap__systable_beginscan(Relation heapRelation, Oid indexId,
+                                       bool indexOK, Snapshot snapshot,
+                                       int nkeys, ScanKey key)
+{
+    if (capturing_planning()) {
+        ic->catalog_scans[RelationGetRelid(heapRelation)]++;
+        ic->catalog_scans_total++;
+    }
+
+    return __real__systable_beginscan(heapRelation, indexId, indexOK,
+                                      snapshot, nkeys, key);
+}
+
+static PartitionPruning &partition_pruning(PlannerInfo *root,
+                                           RelOptInfo *parent,
+                                           const char *method)
+{
+    auto ins = ic->partition_pruning_index.emplace(
+        parent, ic->partition_pruning.size());
+
+    if (ins.second) {
+        const void *id = capture_object(parent).id;
+        Oid oid = root ? root->simple_rte_array[parent->relid]->relid
+                       : InvalidOid;
+
+        ic->partition_pruning.push_back(PartitionPruning(id, root, oid,
+                                                         method));
+
+        ListCell *lc;
+        foreach(lc, parent->baserestrictinfo) {
+            auto *rinfo = static_cast<RestrictInfo *>(lfirst(lc));
+            ic->partition_pruning.back().quals.push_back(
+                capture_object(rinfo->clause).id);
+        }
+    }
+
+    return ic->partition_pruning[ins.first->second];
+}
+
+#if PG_VERSION_NUM >= 110000
+// PlannerInfo of the innermost phase in progress.
+static PlannerInfo *innermost_root()
+{
+    for (auto it = ic->phases.rbegin(); it != ic->phases.rend(); ++it) {
+        if (it->end == 0 && it->root)
+            return static_cast<PlannerInfo *>(const_cast<void *>(it->root));
+    }
+    return nullptr;
+}
+
+// Doesn't get PlannerInfo.
+Relids __wrap__prune_append_rel_partitions(RelOptInfo *rel)
+{
+    if (!ic)
+        return __real__prune_append_rel_partitions(rel);
+
+    const uint64_t begin = capture_timestamp();
+    Relids live = __real__prune_append_rel_partitions(rel);
+    const uint64_t time = capture_timestamp() - begin;
+
+    auto &pruning = partition_pruning(innermost_root(), rel,
+                                      "partition_prune");
+    pruning.partitions = rel->nparts;
+    pruning.pruned = rel->nparts - bms_num_members(live);
+    pruning.time += time;
+    return live;
+}
+
+PartitionPruneInfo *__wrap__make_partition_pruneinfo(PlannerInfo *root,
+                                                     RelOptInfo *parentrel,
+                                                     List *subpaths,
+                                                     PRUNEINFO_PARAMS)
+{
+    auto *pruneinfo = __real__make_partition_pruneinfo(root, parentrel,
+                                                       subpaths,
+                                                       PRUNEINFO_ARGS);
+    if (ic && pruneinfo)
+        partition_pruning(root, parentrel, "partition_prune").runtime = true;
+
+    return pruneinfo;
+}
+#else
+// Called for each child of an appendrel in set_append_rel_size(), the
+// pruned ones get dummy paths.
+bool __wrap__relation_excluded_by_constraints(PlannerInfo *root,
+                                              RelOptInfo *rel,
+                                              RangeTblEntry *rte)
+{
+    if (!ic || rel->reloptkind != RELOPT_OTHER_MEMBER_REL ||
+        rte->rtekind != RTE_RELATION)
+        return __real__relation_excluded_by_constraints(root, rel, rte);
+
+    const uint64_t begin = capture_timestamp();
+    bool excluded = __real__relation_excluded_by_constraints(root, rel, rte);
+    const uint64_t time = capture_timestamp() - begin;
+
+    auto *appinfo = find_childrel_appendrelinfo(root, rel);
+    auto &pruning = partition_pruning(
+        root, root->simple_rel_array[appinfo->parent_relid],
+        "constraint_exclusion");
+
+    pruning.partitions++;
+    pruning.pruned += excluded;
+    pruning.time += time;
+    return excluded;
+}
+#endif
+
+// Fast-path locks live in PGPROC, taking one flips a slot's bits.
+LockAcquireResult __wrap__LockAcquireExtended(const LOCKTAG *locktag,
+                                              LOCKMODE lockmode,
+                                              bool sessionLock,
+                                              bool dontWait,
+                                              LOCK_ACQUIRE_PARAMS)
+{
+    if (!capturing_planning())
+        return __real__LockAcquireExtended(locktag, lockmode, sessionLock,
+                                           dontWait, LOCK_ACQUIRE_ARGS);
+
+    const uint64 fp_lock_bits = MyProc->fpLockBits;
+    const uint64_t begin = capture_timestamp();
+    auto res = __real__LockAcquireExtended(locktag, lockmode, sessionLock,
+                                           dontWait, LOCK_ACQUIRE_ARGS);
+    const uint64_t time = capture_timestamp() - begin;
+
+    auto &locks = locktag->locktag_type == LOCKTAG_RELATION
+        ? ic->locks_by_relation[locktag->locktag_field2]
+        : ic->other_locks;
+
+    locks.time += time;
+    if (res == LOCKACQUIRE_OK) {
+        locks.locks++;
+        locks.fast_path += MyProc->fpLockBits != fp_lock_bits;
+    } else if (res != LOCKACQUIRE_NOT_AVAIL) {
+        locks.already_held++;
+    }
+
+    return res;
+}
+
+PlannerInfo *__wrap__subquery_planner(PlannerGlobal *glob, Query *parse,
+                                      PlannerInfo *parent_root,
+                                      bool hasRecursion,
+                                      double tuple_fraction)
+{
+    if (!ic)
+        return __real__subquery_planner(glob, parse, parent_root,
+                                        hasRecursion, tuple_fraction);
+
+    // PlannerInfo is created inside, patch the phase once we have it.
+    size_t phase = begin_phase("subquery_planner", nullptr);
+    auto root = __real__subquery_planner(glob, parse, parent_root,
+                                         hasRecursion, tuple_fraction);
+    ic->phases[phase].root = root;
+    end_phase(phase);
+    return root;
+}
+
+RelOptInfo *__wrap__query_planner(PlannerInfo *root, List *tlist,
+                                  query_pathkeys_callback qp_callback,
+                                  void *qp_extra)
+{
+    if (!ic)
+        return __real__query_planner(root, tlist, qp_callback, qp_extra);
+
+    size_t phase = begin_phase("query_planner", root);
+    auto rel = __real__query_planner(root, tlist, qp_callback, qp_extra);
+    end_phase(phase);
+
+    // The final scan/join rel, upper planning starts here.
+    ic->current_rel[root] = rel;
+    return rel;
+}
+
+RelOptInfo *__wrap__make_one_rel(PlannerInfo *root, List *joinlist)
+{
+    if (!ic)
+        return __real__make_one_rel(root, joinlist);
+
+    size_t phase = begin_phase("make_one_rel", root);
+    auto rel = __real__make_one_rel(root, joinlist);
+    end_phase(phase);
+    return rel;
+}
+
+RelOptInfo *__wrap__standard_join_search(PlannerInfo *root,
+                                         int levels_needed,
+                                         List *initial_rels)
+{
+    if (!ic)
+        return __real__standard_join_search(root, levels_needed,
+                                            initial_rels);
+
+    size_t phase = begin_phase("standard_join_search", root);
+    auto rel = __real__standard_join_search(root, levels_needed,
+                                            initial_rels);
+    end_phase(phase);
+    return rel;
+}
+
+Plan *__wrap__create_plan(PlannerInfo *root, Path *best_path)
+{
+    if (!ic) {
+        auto plan = __real__create_plan(root, best_path);
+        dispatch_event(PLANSCAPE_EVENT_CREATE_PLAN, root, nullptr, best_path,
+                       plan);
+        return plan;
+    }
+
+    charge_usage(root);
+    capture_object(best_path).isChosen = true;
+    exclude_capture();
+
+    size_t phase = begin_phase("create_plan", root);
+    auto plan = __real__create_plan(root, best_path);
+    end_phase(phase);
+
+    dispatch_event(PLANSCAPE_EVENT_CREATE_PLAN, root, nullptr, best_path,
+                   plan);
+
+    // Planning proper is over once the top level plan is built.
+    if (planner_depth == 1 && !root->parent_root)
+        profiler_stop();
+
+    return plan;
+}
+
+// The 'hooks' capture backend. Paths are snapshotted once a rel's
+// pathlist is complete rather than caught in add_path(), hence only the
+// survivors are seen and there are no cost breakdowns, dominance or
+// chosen path marks.
+static bool capturing_hooks()
+{
+    return ic && ic->backend == CaptureBackend::Hooks;
+}
+
+// Without the outNode() and pfree() hooks, objects nested in the one
+// serialized get neither ids nor X-REFs, and the memory of a freed path
+// may be reused by another one. Objects are hence serialized one by
+// one with the stock outNode() and post-processed: children captured
+// are replaced with X-REFs, Consts get :x-constvalue and referenced
+// OIDs are recorded. An object is identified by its address and
+// signature, a path found where a different one was is captured anew.
+
+static void list_children(List *list, std::vector<const void *> &children)
+{
+    ListCell *lc;
+    foreach(lc, list)
+        children.push_back(lfirst(lc));
+}
+
+// Paths @obj, a RelOptInfo or a Path, refers to directly.
+static void node_children(const Node *obj, std::vector<const void *> &children)
+{
+    switch (nodeTag(obj)) {
+    case T_RelOptInfo: {
+        auto *rel = reinterpret_cast<const RelOptInfo *>(obj);
+        list_children(rel->pathlist, children);
+        list_children(rel->partial_pathlist, children);
+        list_children(rel->cheapest_parameterized_paths, children);
+        children.push_back(rel->cheapest_startup_path);
+        children.push_back(rel->cheapest_total_path);
+        children.push_back(rel->cheapest_unique_path);
+        break;
+    }
+    case T_BitmapHeapPath:
+        children.push_back(reinterpret_cast<const BitmapHeapPath *>(obj)->bitmapqual);
+        break;
+    case T_BitmapAndPath:
+        list_children(reinterpret_cast<const BitmapAndPath *>(obj)->bitmapquals, children);
+        break;
+    case T_BitmapOrPath:
+        list_children(reinterpret_cast<const BitmapOrPath *>(obj)->bitmapquals, children);
+        break;
+    case T_ForeignPath:
+        children.push_back(reinterpret_cast<const ForeignPath *>(obj)->fdw_outerpath);
+        break;
+    case T_CustomPath:
+        list_children(reinterpret_cast<const CustomPath *>(obj)->custom_paths, children);
+        break;
+    case T_NestPath:
+    case T_MergePath:
+    case T_HashPath: {
+        auto *path = reinterpret_cast<const JoinPath *>(obj);
+        children.push_back(path->outerjoinpath);
+        children.push_back(path->innerjoinpath);
+        break;
+    }
+    case T_AppendPath:
+        list_children(reinterpret_cast<const AppendPath *>(obj)->subpaths, children);
+        break;
+    case T_MergeAppendPath:
+        list_children(reinterpret_cast<const MergeAppendPath *>(obj)->subpaths, children);
+        break;
+    case T_ModifyTablePath:
+        list_children(reinterpret_cast<const ModifyTablePath *>(obj)->subpaths, children);
+        break;
+    case T_RecursiveUnionPath: {
+        auto *path = reinterpret_cast<const RecursiveUnionPath *>(obj);
+        children.push_back(path->leftpath);
+        children.push_back(path->rightpath);
+        break;
+    }
+#define SUBPATH(type) \
+    case T_##type: \
+        children.push_back(reinterpret_cast<const type *>(obj)->subpath); \
+        break;
+    SUBPATH(SubqueryScanPath)
+    SUBPATH(MaterialPath)
+    SUBPATH(UniquePath)
+    SUBPATH(GatherPath)
+#if PG_VERSION_NUM >= 100000
+    SUBPATH(GatherMergePath)
+    SUBPATH(ProjectSetPath)
+#endif
+    SUBPATH(ProjectionPath)
+    SUBPATH(SortPath)
+    SUBPATH(GroupPath)
+    SUBPATH(UpperUniquePath)
+    SUBPATH(AggPath)
+    SUBPATH(GroupingSetsPath)
+    SUBPATH(WindowAggPath)
+    SUBPATH(SetOpPath)
+    SUBPATH(LockRowsPath)
+    SUBPATH(LimitPath)
+#undef SUBPATH
+    default:
+        break;
+    }
+}
+
+// Same signature, same object. Rels change as paths are added, their
+// relids don't.
+static size_t node_signature(const void *obj, const std::string &plain)
+{
+    if (IsA(obj, RelOptInfo))
+        return std::hash<std::string>()(
+            format_relids(reinterpret_cast<const RelOptInfo *>(obj)->relids));
+
+    if (IsA(obj, PlannerInfo))
+        return 0;
+
+    return std::hash<std::string>()(plain);
+}
+
+static void replace_all(std::string &data, const std::string &from,
+                        const std::string &to)
+{
+    for (size_t pos = data.find(from); pos != std::string::npos;
+         pos = data.find(from, pos + to.size()))
+        data.replace(pos, from.size(), to);
+}
+
+// OIDs sniff_object() records, from the node string.
+static void sniff_string(const std::string &data)
+{
+    static const struct {
+        const char *field;
+        std::unordered_set<Oid> InstrumentationContext::*oids;
+    } fields[] = {
+        {":vartype ",        &InstrumentationContext::types},
+        {":consttype ",      &InstrumentationContext::types},
+        {":opresulttype ",   &InstrumentationContext::types},
+        {":funcresulttype ", &InstrumentationContext::types},
+        {":opno ",           &InstrumentationContext::operators},
+        {":opfuncid ",       &InstrumentationContext::functions},
+        {":funcid ",         &InstrumentationContext::functions},
+    };
+
+    for (const auto &field: fields) {
+        const size_t len = strlen(field.field);
+
+        for (size_t pos = data.find(field.field); pos != std::string::npos;
+             pos = data.find(field.field, pos + len))
+            (ic->*field.oids).insert(strtoul(data.c_str() + pos + len,
+                                             nullptr, 10));
+    }
+}
+
+// Human readable values of Consts, as __wrap__outNode() adds them.
+static void annotate_consts(std::string &data)
+{
+    for (size_t pos = data.find("{CONST "); pos != std::string::npos;
+         pos = data.find("{CONST ", pos + 1)) {
+
+        const size_t end = data.find('}', pos);
+        if (end == std::string::npos)
+            break;
+
+        std::string text = data.substr(pos, end + 1 - pos);
+        auto *c = reinterpret_cast<Const *>(stringToNode(&text[0]));
+
+        if (!c->constisnull) {
+            Oid   typeoutput;
+            bool  typeIsVarlena;
+            char *result;
+            StringInfoData str;
+
+            getTypeOutputInfo(c->consttype, &typeoutput, &typeIsVarlena);
+            result = OidOutputFunctionCall(typeoutput, c->constvalue);
+
+            initStringInfo(&str);
+            appendStringInfo(&str, " :x-constvalue ");
+            outDatum(&str, PointerGetDatum(result), -2, false);
+            data.insert(end, str.data);
+
+            pfree(str.data);
+            pfree(result);
+        }
+
+        pfree(c);
+    }
+}
+
+// Capture @p unless it was captured already, its stock serialization
+// is stored in @plain.
+static PgObject &snapshot_object(const void *p, std::string *plain)
+{
+    char *repr = nodeToString(p);
+    *plain = repr;
+    pfree(repr);
+
+    const size_t signature = node_signature(p, *plain);
+
+    auto it = ic->samples_index.find(p);
+    if (it != ic->samples_index.end() && ic->signatures[p] == signature)
+        return ic->samples[it->second];
+
+    // Another object at the same address, made up an id.
+    const void *id = p;
+    if (it != ic->samples_index.end()) {
+        ic->synthetic_ids.emplace_back();
+        id = &ic->synthetic_ids.back();
+    }
+
+    std::string data = *plain;
+
+    std::vector<const void *> children;
+    node_children(reinterpret_cast<const Node *>(p), children);
+
+    std::vector<std::pair<std::string, const void *>> refs;
+    for (const void *child: children) {
+        if (!child) continue;
+
+        std::string child_plain;
+        const void *child_id = snapshot_object(child, &child_plain).id;
+        refs.emplace_back(std::move(child_plain), child_id);
+    }
+
+    // A child may contain another one, replace outer ones first.
+    std::sort(refs.begin(), refs.end(),
+              [] (const auto &a, const auto &b) {
+                  return a.first.size() > b.first.size();
+              });
+
+    char xref[64];
+    for (const auto &ref: refs) {
+        snprintf(xref, sizeof xref, "{X-REF :x-id %p}", ref.second);
+        replace_all(data, ref.first, xref);
+    }
+
+    sniff_string(data);
+    annotate_consts(data);
+
+    if (!data.empty() && data.back() == '}') {
+        data.pop_back();
+
+        auto tag = nodeTag(p);
+        if (tag >= T_Path && tag <= T_LimitPath) {
+            char *param_info = nodeToString(
+                reinterpret_cast<const Path *>(p)->param_info);
+            data += " :x-param_info ";
+            data += param_info;
+            pfree(param_info);
+        }
+
+        snprintf(xref, sizeof xref, " :x-id %p}", id);
+        data += xref;
+    }
+
+    ic->samples.push_back(PgObject(id, data.c_str()));
+    ic->samples_index[p] = ic->samples.size() - 1;
+    ic->signatures[p] = signature;
+    return ic->samples.back();
+}
+
+static PgObject &snapshot_object(const void *p)
+{
+    std::string plain;
+    return snapshot_object(p, &plain);
+}
+
+static void snapshot_paths(const RelOptInfo *rel, List *pathlist,
+                           const char *event)
+{
+    ListCell *lc;
+    foreach(lc, pathlist) {
+        auto &desc = snapshot_object(lfirst(lc));
+
+        // Not seen in an earlier snapshot, possibly as a subpath.
+        if (!desc.event)
+            capture_event(desc, event).parent = rel;
+    }
+}
+
+static void snapshot_rel(const PlannerInfo *root, RelOptInfo *rel,
+                         const char *event)
+{
+    charge_usage(rel);
+
+    snapshot_object(root);
+    auto &desc = snapshot_object(rel);
+    if (!desc.event)
+        capture_event(desc, event).parent = root;
+
+    snapshot_paths(rel, rel->pathlist, "add_path");
+    snapshot_paths(rel, rel->partial_pathlist, "add_partial_path");
+    exclude_capture();
+}
+
+static void planscape_set_rel_pathlist(PlannerInfo *root, RelOptInfo *rel,
+                                       Index rti, RangeTblEntry *rte)
+{
+    if (set_rel_pathlist_hook_next)
+        set_rel_pathlist_hook_next(root, rel, rti, rte);
+
+    if (!capturing_hooks())
+        return;
+
+    snapshot_rel(root, rel, "build_simple_rel");
+    if (rte->rtekind == RTE_RELATION)
+        ic->samples[ic->samples_index[rel]].oid = rte->relid;
+}
+
+// Called for every pair of input rels joined.
+static void planscape_set_join_pathlist(PlannerInfo *root,
+                                        RelOptInfo *joinrel,
+                                        RelOptInfo *outerrel,
+                                        RelOptInfo *innerrel,
+                                        JoinType jointype,
+                                        JoinPathExtraData *extra)
+{
+    if (set_join_pathlist_hook_next)
+        set_join_pathlist_hook_next(root, joinrel, outerrel, innerrel,
+                                    jointype, extra);
+
+    if (!capturing_hooks())
+        return;
+
+    auto ins = ic->join_rels_index.emplace(joinrel, ic->join_rels.size());
+    if (ins.second)
+        ic->join_rels.push_back(JoinRel(joinrel, root,
+                                        format_relids(joinrel->relids),
+                                        bms_num_members(joinrel->relids)));
+    ic->join_rels[ins.first->second].pairs++;
+
+    snapshot_rel(root, joinrel, "build_join_rel");
+}
+
+#if PG_VERSION_NUM >= 110000
+#define UPPER_PATHS_EXTRA_PARAM(arg, _) , arg
+#else
+#define UPPER_PATHS_EXTRA_PARAM(arg, _)
+#endif
+
+static void planscape_create_upper_paths(PlannerInfo *root,
+                                         UpperRelationKind stage,
+                                         RelOptInfo *input_rel,
+                                         RelOptInfo *output_rel
+                 UPPER_PATHS_EXTRA_PARAM(void *extra,))
+{
+    if (create_upper_paths_hook_next)
+        create_upper_paths_hook_next(root, stage, input_rel, output_rel
+                                     UPPER_PATHS_EXTRA_PARAM(extra,));
+
+    if (!capturing_hooks())
+        return;
+
+    auto ins = ic->upper_rels_index.emplace(output_rel, ic->upper_rels.size());
+    if (ins.second)
+        ic->upper_rels.push_back(UpperRel(output_rel, root, stage));
+
+    auto &upper = ic->upper_rels[ins.first->second];
+    upper.input = input_rel;
+    upper.paths = list_length(output_rel->pathlist);
+    upper.partial_paths = list_length(output_rel->partial_pathlist);
+
+    snapshot_rel(root, output_rel, "fetch_upper_rel");
+}
+
+#undef UPPER_PATHS_EXTRA_PARAM
+
+static CaptureBackend current_backend()
+{
+    // Code patched in the postmaster is live anyway, capture with it.
+    return hooks_preloaded ? CaptureBackend::Patch
+                           : CaptureBackend(capture_backend);
+}
+
+static std::unique_ptr<InstrumentationContext>
+create_capture_context(ReportFormat format, CaptureBackend backend)
+{
+    auto icontext = create_instrumentation_context(perf_counters_enabled,
+                                                   track_memory);
+
+    if (perf_counters_enabled && !icontext->perf)
+        ereport(WARNING,
+                (errmsg("PLANSCAPE perf counters unavailable: %m")));
+
+    icontext->format = format;
+    icontext->backend = backend;
+    icontext->geqo_summarize = geqo_summarize;
+    icontext->fold_partitions = fold_partitions;
+    icontext->dominance_enabled = track_dominance;
+    profiler_reset();
+
+    return icontext;
+}
+
+static PlannedStmt *armed_planner(Query *parse,
+                                  int cursorOptions,
+                                  ParamListInfo boundParams);
+
+static PlannedStmt *planscape_planner(Query *parse,
+                                      int cursorOptions,
+                                      ParamListInfo boundParams)
+{
+    // Capture armed by planscape_capture_backend()? The slot is looked
+    // up on the first invocation.
+    if (planner_depth == 0 && !ic) {
+        if (!arm_attached) {
+            arm_attach();
+            arm_attached = true;
+        }
+
+        if (arm_pending() && arm_consume())
+            return armed_planner(parse, cursorOptions, boundParams);
+    }
+
+    PlannedStmt *result;
+    const bool profile = ic && profile_frequency > 0 && planner_depth == 0;
+
+    if (ic && ic->memory && planner_depth == 0) {
+        // Memory allocated prior to planning isn't charged to anyone.
+        ic->planner_context = CurrentMemoryContext;
+        ic->last_reading.memory = memory_context_allocated(CurrentMemoryContext);
+        ic->first_reading.memory = ic->last_reading.memory;
+    }
+
+    if (profile && !profiler_start(profile_frequency))
+        ereport(WARNING,
+                (errmsg("failed to start PLANSCAPE sampling profiler: %m")));
+
+    // Statistics cover the top level planner invocation, nested ones
+    // included.
+    PlanningCounters counters;
+    const bool tracked = track_stats && planner_depth == 0
+                         && parse->queryId != 0 && stats_available();
+    const uint64 start = tracked ? capture_timestamp() : 0;
+    const uint64 overhead = ic ? ic->overhead.time : 0;
+
+    if (tracked)
+        planning_counters = &counters;
+
+    if (ic && planner_depth == 0)
+        ic->queryid = parse->queryId;
+
+    planner_depth++;
+
+    // No finer-grained phases without patching.
+    const size_t phase = capturing_hooks() ? begin_phase("planner", nullptr)
+                                           : SIZE_MAX;
+
+    PG_TRY();
+    {
+        result = planner_hook_next(parse, cursorOptions, boundParams);
+    }
+    PG_CATCH();
+    {
+        planner_depth--;
+
+        if (tracked)
+            planning_counters = nullptr;
+
+        // Unwound past catalog lookups in progress.
+        if (ic)
+            ic->catalog_depth = 0;
+
+        if (profile)
+            profiler_stop();
+
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    planner_depth--;
+
+    if (phase != SIZE_MAX)
+        end_phase(phase);
+
+    if (tracked) {
+        planning_counters = nullptr;
+        if (ic)
+            counters.capture_time = ic->overhead.time - overhead;
+        stats_record(MyDatabaseId, parse->queryId, counters,
+                     capture_timestamp() - start, ic != nullptr);
+    }
+
+    if (profile)
+        profiler_stop();
+
+    return result;
+}
+
+static std::string write_report_file(const std::string &report_data)
+{
+    char path_buf[] = "/tmp/XXXXXX";
+    int fd = mkstemp(path_buf);
+    write(fd, report_data.c_str(), report_data.size()); 
+    fchmod(fd, 0604);
+    close(fd);
+    return path_buf;
+}
+
+static std::string submit_report()
+{
+    std::ostringstream os;
+    if (ic->format == ReportFormat::Trace)
+        make_trace_report(os, *ic);
+    else
+        make_report(os, *ic);
+    return write_report_file(os.str());
+}
+
+static std::string write_spool_file(const std::string &report_data)
+{
+    std::string path = std::string(spool_directory) + "/planscape-"
+                       + std::to_string(MyProcPid) + "-XXXXXX.json";
+    std::vector<char> path_buf(path.begin(), path.end());
+    path_buf.push_back('\0');
+
+    int fd = mkstemps(path_buf.data(), strlen(".json"));
+    if (fd == -1)
+        return "";
+
+    write(fd, report_data.c_str(), report_data.size());
+    close(fd);
+    return path_buf.data();
+}
+
+// Reporting since @begin is time spent capturing the statement.
+static void record_report_time(const InstrumentationContext &capture,
+                               uint64_t begin)
+{
+    if (track_stats && capture.queryid != 0 && stats_available())
+        stats_record_capture(MyDatabaseId, capture.queryid,
+                             capture_timestamp() - begin);
+}
+
+// Write the report of a capture armed remotely to the spool directory.
+static void spool_report(InstrumentationContext &capture)
+{
+    const uint64_t begin = capture_timestamp();
+
+    std::ostringstream os;
+    make_report(os, capture);
+    clear_instrumentation_context(capture);
+    record_report_time(capture, begin);
+
+    std::string path = write_spool_file(os.str());
+    if (path.empty())
+        ereport(WARNING,
+                (errcode_for_file_access(),
+                 errmsg("could not write PLANSCAPE report to \"%s\": %m",
+                        spool_directory)));
+    else
+        ereport(LOG,
+                (errmsg("PLANSCAPE report written to \"%s\"",
+                        path.c_str())));
+}
+
+// Planning with a capture armed remotely. Problems with the capture
+// must not fail the application's statement, they are merely logged;
+// errors raised while planning are the statement's own.
+static PlannedStmt *armed_planner(Query *parse,
+                                  int cursorOptions,
+                                  ParamListInfo boundParams)
+{
+    const auto backend = current_backend();
+    const bool patch = backend == CaptureBackend::Patch;
+
+    if (patch && !install_hooks()) {
+        ereport(WARNING,
+                (errmsg("failed to install PLANSCAPE hooks, capture skipped"),
+                 errhint("%s", hook_last_error())));
+        return planscape_planner(parse, cursorOptions, boundParams);
+    }
+
+    if (patch && !enable_hooks()) {
+        ereport(WARNING,
+                (errmsg("failed to enable PLANSCAPE hooks, capture skipped"),
+                 errhint("%s", hook_last_error())));
+        return planscape_planner(parse, cursorOptions, boundParams);
+    }
+
+    auto icontext = create_capture_context(ReportFormat::Json, backend);
+    PlannedStmt *result;
+
+    PG_TRY();
+    {
+        ic = icontext.get();
+        result = planscape_planner(parse, cursorOptions, boundParams);
+    }
+    PG_CATCH();
+    {
+        ic = nullptr;
+
+        if (patch)
+            disable_hooks();
+
+        // NB: explicit destruction needed; PG_RE_THROW() is a
+        // longjump in disguise.
+        icontext.reset();
+
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    ic = nullptr;
+
+    if (patch)
+        disable_hooks();
+
+    // No subtransactions in parallel mode (planning from a parallel
+    // safe function), and BeginInternalSubTransaction() would fail the
+    // statement.
+    if (IsInParallelMode()) {
+        ereport(WARNING,
+                (errmsg("PLANSCAPE report skipped in parallel mode")));
+        profiler_reset();
+        return result;
+    }
+
+    // Report in a subtransaction, so that whatever it acquired is
+    // released should it fail.
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ResourceOwner oldowner = CurrentResourceOwner;
+
+    BeginInternalSubTransaction(NULL);
+    MemoryContextSwitchTo(oldcontext);
+
+    PG_TRY();
+    {
+        spool_report(*icontext);
+
+        ReleaseCurrentSubTransaction();
+        MemoryContextSwitchTo(oldcontext);
+        CurrentResourceOwner = oldowner;
+    }
+    PG_CATCH();
+    {
+        MemoryContextSwitchTo(oldcontext);
+        ErrorData *edata = CopyErrorData();
+        FlushErrorState();
+
+        RollbackAndReleaseCurrentSubTransaction();
+        MemoryContextSwitchTo(oldcontext);
+        CurrentResourceOwner = oldowner;
+
+        ereport(WARNING,
+                (errmsg("could not make PLANSCAPE report: %s",
+                        edata->message)));
+        FreeErrorData(edata);
+    }
+    PG_END_TRY();
+
+    profiler_reset();
+    return result;
+}
+
+static void explain_property(ExplainState *es, const char *name,
+                             const std::string &value)
+{
+    if (es->format == EXPLAIN_FORMAT_TEXT)
+        appendStringInfo(es->str, "%s: %s\n", name, value.c_str());
+    else
+        ExplainPropertyText(name, value.c_str(), es);
+}
+
+// Produce the report, @emit(name, value) outputs a property.
+template<typename Emit>
+static void emit_report(Emit emit)
+{
+    const uint64_t begin = capture_timestamp();
+
+    if (ic->format == ReportFormat::Counters) {
+        for (const auto &counter: make_counters(*ic))
+            emit(counter.first.c_str(), counter.second);
+        clear_instrumentation_context(*ic);
+    } else {
+        std::string url = submit_report();
+        clear_instrumentation_context(*ic);
+
+        emit("Planscape URL", url);
+    }
+
+    if (profiler_has_samples()) {
+        std::ostringstream folded, pprof;
+
+        make_folded_report(folded);
+        make_pprof_report(pprof);
+        profiler_reset();
+
+        emit("Planscape Profile", write_report_file(folded.str()));
+        emit("Planscape pprof", write_report_file(pprof.str()));
+    }
+
+    record_report_time(*ic, begin);
+}
+
+void __wrap__ExplainPrintPlan(ExplainState *es, QueryDesc *queryDesc)
+{
+    if (!ic)
+        return __real__ExplainPrintPlan(es, queryDesc);
+
+    __real__ExplainPrintPlan(es, queryDesc);
+
+    emit_report([es] (const char *name, const std::string &value) {
+        explain_property(es, name, value);
+    });
+}
+
+// ExplainPrintPlan() isn't hooked by the 'hooks' backend, report once
+// EXPLAIN is over instead.
+static void notice_report()
+{
+    emit_report([] (const char *name, const std::string &value) {
+        ereport(NOTICE, (errmsg("%s: %s", name, value.c_str())));
+    });
+}
+
+static ReportFormat parse_report_format(DefElem *opt)
+{
+    const char *format = defGetString(opt);
+
+    if (strcmp(format, "json") == 0)
+        return ReportFormat::Json;
+
+    if (strcmp(format, "trace") == 0)
+        return ReportFormat::Trace;
+
+    if (strcmp(format, "counters") == 0)
+        return ReportFormat::Counters;
+
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+    errmsg("unrecognized value for EXPLAIN option \"%s\": \"%s\"",
+           opt->defname, format)));
+
+    return ReportFormat::Json; // keep compiler quiet
+}
+
+static Node *remove_planscape_options_from_explain_stmt(Node *parsetree,
+                                                        bool *enable_planscape,
+                                                        ReportFormat *format)
+{
+    assert(IsA(parsetree, ExplainStmt));
+    *enable_planscape = false;
+    *format = ReportFormat::Json;
+
+    auto *explain = reinterpret_cast<ExplainStmt *>(parsetree);
+    auto *explain_copy = makeNode(ExplainStmt);
+
+    // Scan list for 'planscape' option.
+    // Produce a copy of options list, removing 'planscape' options.
+    ListCell *lc;
+    foreach(lc, explain->options) {
+        assert(IsA(lfirst(lc), DefElem));
+        auto *opt = reinterpret_cast<DefElem *>(lfirst(lc));
+        if (strcmp(opt->defname, "planscape") == 0) {
+            *enable_planscape = defGetBoolean(opt);
+        } else if (strcmp(opt->defname, "planscape_format") == 0) {
+            *format = parse_report_format(opt);
+        } else {
+            explain_copy->options = lappend(explain_copy->options, opt);
+        }
+    }
+
+    explain_copy->query = explain->query;
+    return reinterpret_cast<Node *>(explain_copy);
+}
+
+#if PG_VERSION_NUM >= 100000
+#define QUERY_ENVIRONMENT_PARAM(arg, _) arg,
+#else
+#define QUERY_ENVIRONMENT_PARAM(arg, _)
+#endif
+
+static void process_utility(
+#if PG_VERSION_NUM >= 100000
+                            PlannedStmt *parsetree,
+#else
+                            Node *parsetree,
+#endif
+                            const char *queryString,
+                            ProcessUtilityContext context,
+                            ParamListInfo paramListInfo,
+    QUERY_ENVIRONMENT_PARAM(QueryEnvironment *queryEnvironment,)
+                            DestReceiver *destReceiver,
+                            char *completionTag)
+{
+    bool enable_planscape;
+    ReportFormat format;
+
+#if PG_VERSION_NUM >= 100000
+    if (IsA(parsetree->utilityStmt, ExplainStmt)) {
+
+        parsetree->utilityStmt = remove_planscape_options_from_explain_stmt(
+                parsetree->utilityStmt, &enable_planscape, &format);
+#else
+    if (IsA(parsetree, ExplainStmt)) {
+
+        parsetree = remove_planscape_options_from_explain_stmt(
+                parsetree, &enable_planscape, &format);
+
+#endif
+        // Create new IC
+        std::unique_ptr<InstrumentationContext> icontext;
+
+        const auto backend = current_backend();
+        const bool patch = backend == CaptureBackend::Patch;
+
+        if (enable_planscape && patch) {
+
+            if (!install_hooks()) {
+                ereport(ERROR,
+                        (errcode(ERRCODE_SYSTEM_ERROR),
+                errmsg("failed to install PLANSCAPE hooks"),
+                errhint("%s", hook_last_error())));
+            }
+
+            if (!enable_hooks()) {
+                ereport(ERROR,
+                        (errcode(ERRCODE_SYSTEM_ERROR),
+                errmsg("failed to enable PLANSCAPE hooks"),
+                errhint("%s", hook_last_error())));
+            }
+        }
+
+        if (enable_planscape)
+            icontext = create_capture_context(format, backend);
+
+        auto * const ic_prev = ic;
+
+        PG_TRY();
+        {
+            ic = icontext.get();
+
+            process_utility_hook_next(parsetree,
+                                      queryString,
+                                      context,
+                                      paramListInfo,
+              QUERY_ENVIRONMENT_PARAM(queryEnvironment,)
+                                      destReceiver,
+                                      completionTag);
+
+            if (icontext && !patch)
+                notice_report();
+
+            ic = ic_prev;
+
+            if (icontext && patch)
+                disable_hooks();
+        }
+        PG_CATCH();
+        {
+            ic = ic_prev;
+
+            if (icontext && patch)
+                disable_hooks();
+
+            // NB: explicit destruction needed; PG_RE_THROW() is a
+            // longjump in disguise.
+            icontext.reset();
+
+            PG_RE_THROW();
+        }
         PG_END_TRY();
 
     } else {
@@ -413,9 +2625,318 @@ static void process_utility(
 
 #undef QUERY_ENVIRONMENT_PARAM
 
+// The tracer lost track of a return address: abandon the statement
+// rather than the backend.
+static void tracer_error(const char *message)
+{
+    ereport(ERROR,
+            (errcode(ERRCODE_INTERNAL_ERROR),
+    errmsg("PLANSCAPE tracer: %s", message)));
+}
+
+Datum planscape_trace_function(PG_FUNCTION_ARGS)
+{
+    char *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    std::string error;
+
+    if (!tracer_trace(name, &error))
+        ereport(ERROR,
+                (errcode(ERRCODE_SYSTEM_ERROR),
+        errmsg("failed to trace function \"%s\"", name),
+        errhint("%s", error.c_str())));
+
+    PG_RETURN_VOID();
+}
+
+Datum planscape_untrace_function(PG_FUNCTION_ARGS)
+{
+    char *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    std::string error;
+
+    if (!tracer_untrace(name, &error))
+        ereport(ERROR,
+                (errcode(ERRCODE_SYSTEM_ERROR),
+        errmsg("failed to untrace function \"%s\"", name),
+        errhint("%s", error.c_str())));
+
+    PG_RETURN_VOID();
+}
+
+// Set up a set-returning function to return rows in a tuplestore.
+static Tuplestorestate *materialize_srf(FunctionCallInfo fcinfo,
+                                        TupleDesc *tupdesc)
+{
+    auto *rsinfo = reinterpret_cast<ReturnSetInfo *>(fcinfo->resultinfo);
+
+    if (!rsinfo || !IsA(rsinfo, ReturnSetInfo)
+        || !(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+        errmsg("materialize mode required, but it is not allowed in this context")));
+
+    if (get_call_result_type(fcinfo, nullptr, tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    MemoryContext oldcontext =
+        MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+    Tuplestorestate *tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = *tupdesc;
+
+    MemoryContextSwitchTo(oldcontext);
+
+    return tupstore;
+}
+
+#define PLANSCAPE_TRACE_STATS_COLS 5
+
+Datum planscape_trace_stats(PG_FUNCTION_ARGS)
+{
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore = materialize_srf(fcinfo, &tupdesc);
+
+    for (const TraceStats &stats : tracer_stats()) {
+        Datum values[PLANSCAPE_TRACE_STATS_COLS];
+        bool  nulls[PLANSCAPE_TRACE_STATS_COLS] = {};
+        Datum buckets[TRACE_HISTOGRAM_BUCKETS];
+
+        for (int i = 0; i < TRACE_HISTOGRAM_BUCKETS; i++)
+            buckets[i] = Int64GetDatum(stats.histogram[i]);
+
+        values[0] = CStringGetTextDatum(stats.name.c_str());
+        values[1] = BoolGetDatum(stats.traced);
+        values[2] = Int64GetDatum(stats.calls);
+        values[3] = Float8GetDatum(stats.time / 1e6);
+        values[4] = PointerGetDatum(construct_array(buckets,
+                                                    TRACE_HISTOGRAM_BUCKETS,
+                                                    INT8OID, sizeof(int64),
+                                                    FLOAT8PASSBYVAL, 'd'));
+
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    return (Datum) 0;
+}
+
+static void check_preloaded()
+{
+    if (!stats_available() || !arm_available())
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+        errmsg("planscape must be loaded via shared_preload_libraries")));
+}
+
+#define PLANSCAPE_STATS_COLS 9
+
+Datum planscape_stats(PG_FUNCTION_ARGS)
+{
+    check_preloaded();
+
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore = materialize_srf(fcinfo, &tupdesc);
+
+    for (const StatsEntry &entry : stats_snapshot()) {
+        Datum values[PLANSCAPE_STATS_COLS];
+        bool  nulls[PLANSCAPE_STATS_COLS] = {};
+
+        values[0] = ObjectIdGetDatum(entry.dbid);
+        values[1] = Int64GetDatum(int64(entry.queryid));
+        values[2] = Int64GetDatum(entry.plans);
+        values[3] = Float8GetDatum(entry.total_time);
+        values[4] = Float8GetDatum(entry.max_time);
+        values[5] = Int64GetDatum(entry.paths);
+        values[6] = Int64GetDatum(entry.join_rels);
+        // Only code patched in the postmaster sees every add_path() and
+        // build_join_rel(), the hooks backend can't count them.
+        nulls[5] = nulls[6] = !hooks_preloaded;
+        values[7] = Int64GetDatum(entry.captures);
+        values[8] = Float8GetDatum(entry.capture_time);
+
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    return (Datum) 0;
+}
+
+Datum planscape_stats_reset(PG_FUNCTION_ARGS)
+{
+    check_preloaded();
+    stats_reset();
+
+    PG_RETURN_VOID();
+}
+
+Datum planscape_capture_backend(PG_FUNCTION_ARGS)
+{
+    const int pid = PG_GETARG_INT32(0);
+    const int count = PG_GETARG_INT32(1);
+
+    if (!superuser())
+        ereport(ERROR,
+                (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+        errmsg("must be superuser to arm PLANSCAPE captures")));
+
+    check_preloaded();
+
+    if (count <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+        errmsg("capture count must be positive")));
+
+    if (!arm_backend(pid, count)) {
+        ereport(WARNING,
+                (errmsg("PID %d is not a PostgreSQL server process", pid)));
+        PG_RETURN_BOOL(false);
+    }
+
+    PG_RETURN_BOOL(true);
+}
+
+static void planscape_shmem_startup()
+{
+    if (shmem_startup_hook_next)
+        shmem_startup_hook_next();
+
+    stats_startup();
+    arm_startup();
+}
+
 void _PG_init()
 {
+    DefineCustomIntVariable("planscape.profile_frequency",
+                            "Sampling profiler frequency during PLANSCAPE "
+                            "capture, Hz.",
+                            "Zero disables the profiler.",
+                            &profile_frequency,
+                            0, 0, 10000,
+                            PGC_USERSET, 0,
+                            nullptr, nullptr, nullptr);
+
+    DefineCustomBoolVariable("planscape.track_memory",
+                             "Track planner memory context growth during "
+                             "PLANSCAPE capture.",
+                             nullptr,
+                             &track_memory,
+                             false,
+                             PGC_USERSET, 0,
+                             nullptr, nullptr, nullptr);
+
+    DefineCustomBoolVariable("planscape.geqo_summarize",
+                             "Summarize GEQO generations instead of "
+                             "capturing every candidate join tree.",
+                             "The winning tour is captured in full.",
+                             &geqo_summarize,
+                             true,
+                             PGC_USERSET, 0,
+                             nullptr, nullptr, nullptr);
+
+    DefineCustomBoolVariable("planscape.fold_partitions",
+                             "Fold sibling partitions with identical path "
+                             "sets in PLANSCAPE reports.",
+                             "Folded partitions are reported as deltas "
+                             "against a template partition.",
+                             &fold_partitions,
+                             true,
+                             PGC_USERSET, 0,
+                             nullptr, nullptr, nullptr);
+
+    DefineCustomBoolVariable("planscape.track_dominance",
+                             "Record which path dominated which in "
+                             "add_path() during PLANSCAPE capture.",
+                             nullptr,
+                             &track_dominance,
+                             false,
+                             PGC_USERSET, 0,
+                             nullptr, nullptr, nullptr);
+
+    DefineCustomEnumVariable("planscape.capture_backend",
+                             "How PLANSCAPE captures planning.",
+                             "'patch' patches planner functions in memory, "
+                             "'hooks' relies on Postgres hooks alone and "
+                             "sees fewer details.",
+                             &capture_backend,
+                             int(CaptureBackend::Patch),
+                             capture_backend_options,
+                             PGC_SUSET, 0,
+                             nullptr, nullptr, nullptr);
+
+    DefineCustomBoolVariable("planscape.track_stats",
+                             "Record planning statistics by statement.",
+                             "Needs planscape in shared_preload_libraries "
+                             "and query identifiers computed.",
+                             &track_stats,
+                             true,
+                             PGC_SUSET, 0,
+                             nullptr, nullptr, nullptr);
+
+    DefineCustomIntVariable("planscape.max_stats",
+                            "Maximum number of statements tracked by "
+                            "planscape_stats.",
+                            nullptr,
+                            &max_stats,
+                            5000, 100, INT_MAX,
+                            PGC_POSTMASTER, 0,
+                            nullptr, nullptr, nullptr);
+
+    DefineCustomStringVariable("planscape.spool_directory",
+                               "Directory reports of captures armed with "
+                               "planscape_capture_backend() are written to.",
+                               nullptr,
+                               &spool_directory,
+                               "/tmp",
+                               PGC_SUSET, 0,
+                               nullptr, nullptr, nullptr);
+
+    DefineCustomBoolVariable("planscape.perf_counters",
+                             "Collect perf_event counters during PLANSCAPE "
+                             "capture.",
+                             "Hardware events if the PMU is available, "
+                             "software events otherwise.",
+                             &perf_counters_enabled,
+                             false,
+                             PGC_USERSET, 0,
+                             nullptr, nullptr, nullptr);
+
+    report_cache_init();
+    events_init();
+    tracer_set_error_handler(tracer_error);
+
+    // Preloaded: patch code once in the postmaster, backends inherit
+    // the patched pages shared rather than each getting private copies.
+    // Hooks stay enabled, captures are toggled by ic alone.
+    if (process_shared_preload_libraries_in_progress
+        && capture_backend == int(CaptureBackend::Patch)) {
+        if (install_hooks() && enable_hooks())
+            hooks_preloaded = true;
+        else
+            ereport(WARNING,
+                    (errmsg("failed to install PLANSCAPE hooks in postmaster"),
+                     errhint("%s", hook_last_error())));
+    }
+
+    if (process_shared_preload_libraries_in_progress) {
+        stats_request(max_stats);
+        arm_request();
+
+        shmem_startup_hook_next = shmem_startup_hook;
+        shmem_startup_hook = planscape_shmem_startup;
+    }
+
     process_utility_hook_next = 
         ProcessUtility_hook ? ProcessUtility_hook : standard_ProcessUtility;
     ProcessUtility_hook = process_utility;
+
+    planner_hook_next = planner_hook ? planner_hook : standard_planner;
+    planner_hook = planscape_planner;
+
+    set_rel_pathlist_hook_next = set_rel_pathlist_hook;
+    set_rel_pathlist_hook = planscape_set_rel_pathlist;
+
+    set_join_pathlist_hook_next = set_join_pathlist_hook;
+    set_join_pathlist_hook = planscape_set_join_pathlist;
+
+    create_upper_paths_hook_next = create_upper_paths_hook;
+    create_upper_paths_hook = planscape_create_upper_paths;
 }
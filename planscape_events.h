@@ -0,0 +1,84 @@
+#pragma once
+
+// Planner event subscription API. Lets other loaded modules observe
+// the planner functions planscape intercepts without patching them
+// again. Planscape publishes a PlanscapeEventsApi through the
+// rendezvous variable PLANSCAPE_EVENTS_RENDEZVOUS; a function is only
+// intercepted while its event has subscribers (or a capture is in
+// progress). Include after postgres.h and fmgr.h.
+//
+// Example:
+//
+// static void on_add_path(const PlanscapeEventData *data, void *arg)
+// {
+//     ...
+// }
+//
+// const PlanscapeEventsApi *api = planscape_events_api();
+// if (api && api->subscribe(PLANSCAPE_EVENT_ADD_PATH, on_add_path, NULL) != 0)
+//     elog(WARNING, "planscape: %s", api->last_error());
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PLANSCAPE_EVENTS_RENDEZVOUS  "planscape_events"
+#define PLANSCAPE_EVENTS_API_VERSION 1
+
+// Subscribers per event, at most.
+#define PLANSCAPE_SUBSCRIBERS_MAX    8
+
+typedef enum PlanscapeEvent
+{
+    PLANSCAPE_EVENT_ADD_PATH,         // add_path() called: rel, path
+    PLANSCAPE_EVENT_ADD_PARTIAL_PATH, // add_partial_path() called: rel, path
+    PLANSCAPE_EVENT_CREATE_PLAN,      // create_plan() done: root, path, plan
+    PLANSCAPE_EVENT_COUNT
+} PlanscapeEvent;
+
+// Fields not applicable to an event are NULL.
+typedef struct PlanscapeEventData
+{
+    PlanscapeEvent      event;
+    struct PlannerInfo *root;
+    struct RelOptInfo  *rel;
+    struct Path        *path;
+    struct Plan        *plan;
+} PlanscapeEventData;
+
+// Invoked synchronously in the planner. Must neither subscribe nor
+// unsubscribe. ereport(ERROR) propagates as usual.
+typedef void (*PlanscapeCallback)(const PlanscapeEventData *data, void *arg);
+
+typedef struct PlanscapeEventsApi
+{
+    int         version; // PLANSCAPE_EVENTS_API_VERSION
+
+    // Invoke @callback with @arg on every @event.
+    //
+    // Returns: 0 if succeeded, non-zero on error, check last_error()
+    int         (*subscribe)(PlanscapeEvent event, PlanscapeCallback callback,
+                             void *arg);
+
+    // Remove a subscription made with the same @callback and @arg.
+    void        (*unsubscribe)(PlanscapeEvent event,
+                               PlanscapeCallback callback, void *arg);
+
+    const char *(*last_error)(void);
+} PlanscapeEventsApi;
+
+// The API if planscape is loaded and compatible, NULL otherwise.
+static inline const PlanscapeEventsApi *planscape_events_api(void)
+{
+    const PlanscapeEventsApi **api = (const PlanscapeEventsApi **)
+        find_rendezvous_variable(PLANSCAPE_EVENTS_RENDEZVOUS);
+
+    if (!*api || (*api)->version != PLANSCAPE_EVENTS_API_VERSION)
+        return NULL;
+
+    return *api;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,232 @@
+#include "profiler.h"
+#include "symboliser.h"
+#include "instrumentation_context.h"
+#include "tracer.h"
+
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <fstream>
+#include <map>
+#include <algorithm>
+
+namespace {
+
+constexpr int    FRAMES_MAX = 64;
+constexpr size_t RING_SIZE  = 8192;
+
+// Frames contributed by the signal handler itself and the signal
+// trampoline.
+constexpr int    FRAMES_SKIP = 2;
+
+struct StackSample
+{
+    int   depth;
+    void *frames[FRAMES_MAX];
+};
+
+using StackCounts = std::map<std::vector<void *>, uint64_t>;
+
+}
+
+static StackSample          *g_ring; // RING_SIZE entries, never freed
+static volatile sig_atomic_t g_ring_head;
+static volatile sig_atomic_t g_armed;
+static bool                  g_handler_installed;
+static timer_t               g_timer;
+static bool                  g_timer_created;
+static int                   g_period_us;
+
+static void sigprof_handler(int, siginfo_t *, void *)
+{
+    if (!g_armed) return;
+
+    int saved_errno = errno;
+
+    StackSample &sample = g_ring[g_ring_head % RING_SIZE];
+    sample.depth = backtrace(sample.frames, FRAMES_MAX);
+    tracer_resolve_backtrace(sample.frames, sample.depth);
+    g_ring_head = g_ring_head + 1;
+
+    errno = saved_errno;
+}
+
+bool profiler_start(int frequency)
+{
+    if (g_timer_created) return true;
+
+    if (!g_ring) {
+        g_ring = static_cast<StackSample *>(malloc(sizeof(StackSample) * RING_SIZE));
+        if (!g_ring) return false;
+
+        // backtrace() loads libgcc on the first call which is not
+        // async-signal-safe, get it out of the way.
+        void *frame;
+        backtrace(&frame, 1);
+    }
+
+    // The handler is never uninstalled: a SIGPROF delivered after the
+    // timer is gone would otherwise kill the backend.
+    if (!g_handler_installed) {
+        struct sigaction sa = {};
+        sa.sa_sigaction = sigprof_handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+
+        if (sigaction(SIGPROF, &sa, nullptr) != 0)
+            return false;
+
+        g_handler_installed = true;
+    }
+
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGPROF;
+
+    if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &sev, &g_timer) != 0)
+        return false;
+
+    g_period_us = std::max(1000000 / std::max(frequency, 1), 1);
+
+    struct itimerspec its = {};
+    its.it_interval.tv_sec = g_period_us / 1000000;
+    its.it_interval.tv_nsec = g_period_us % 1000000 * 1000;
+    its.it_value = its.it_interval;
+
+    g_armed = 1;
+
+    if (timer_settime(g_timer, 0, &its, nullptr) != 0) {
+        int saved_errno = errno;
+        g_armed = 0;
+        timer_delete(g_timer);
+        errno = saved_errno;
+        return false;
+    }
+
+    g_timer_created = true;
+    return true;
+}
+
+void profiler_stop()
+{
+    if (!g_timer_created) return;
+
+    g_armed = 0;
+    timer_delete(g_timer);
+    g_timer_created = false;
+}
+
+void profiler_reset()
+{
+    g_ring_head = 0;
+}
+
+bool profiler_has_samples()
+{
+    return g_ring_head != 0;
+}
+
+// Aggregate identical stacks, leaf first.
+static StackCounts collect_stacks()
+{
+    StackCounts stacks;
+    const size_t n = std::min<size_t>(g_ring_head, RING_SIZE);
+
+    for (size_t i = 0; i < n; i++) {
+
+        const auto &sample = g_ring[i];
+        if (sample.depth <= FRAMES_SKIP) continue;
+
+        stacks[std::vector<void *>(sample.frames + FRAMES_SKIP,
+                                   sample.frames + sample.depth)]++;
+    }
+
+    return stacks;
+}
+
+void make_folded_report(std::ostream &os)
+{
+    auto stacks = collect_stacks();
+
+    // Group distinct frames by module.
+    std::map<const void *, std::pair<std::string, std::vector<void *>>> modules;
+    std::unordered_map<void *, std::string> names;
+
+    for (const auto &stack: stacks) {
+        for (auto *frame: stack.first) {
+
+            if (!names.emplace(frame, "??").second) continue;
+
+            Dl_info dlinfo;
+            if (dladdr(frame, &dlinfo) == 0) continue;
+
+            auto &mi = modules[dlinfo.dli_fbase];
+            if (mi.first.empty())
+                mi.first = module_path(dlinfo.dli_fname);
+            mi.second.push_back(frame);
+        }
+    }
+
+    // Symbolise. Inlined functions become frames of their own, the
+    // outermost function comes first.
+    for (const auto &mitem: modules) {
+
+        Symboliser symboliser(mitem.second.first, mitem.first);
+
+        for (auto *frame: mitem.second.second) {
+
+            std::string name;
+
+            symboliser.symbolise(frame);
+            do {
+                name = name.empty() ? std::string(symboliser.get_fn_name())
+                                    : symboliser.get_fn_name() + (';' + name);
+            } while (symboliser.next());
+
+            names[frame] = name;
+        }
+    }
+
+    // Stacks differing in addresses only collapse into one line.
+    std::map<std::string, uint64_t> folded;
+
+    for (const auto &stack: stacks) {
+
+        const auto &frames = stack.first;
+        std::string line;
+
+        for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+            line += (it == frames.rbegin() ? "" : ";") + names[*it];
+
+        folded[line] += stack.second;
+    }
+
+    for (const auto &line: folded)
+        os << line.first << ' ' << line.second << '\n';
+}
+
+void make_pprof_report(std::ostream &os)
+{
+    auto put = [&] (uint64_t word) {
+        os.write(reinterpret_cast<const char *>(&word), sizeof word);
+    };
+
+    // Header: header words count, version, sampling period, padding.
+    put(0); put(3); put(0); put(g_period_us); put(0);
+
+    for (const auto &stack: collect_stacks()) {
+        put(stack.second);
+        put(stack.first.size());
+        for (auto *frame: stack.first)
+            put(reinterpret_cast<uintptr_t>(frame));
+    }
+
+    // Trailer, followed by the memory map for pprof to find binaries.
+    put(0); put(1); put(0);
+
+    std::ifstream maps("/proc/self/maps");
+    os << maps.rdbuf();
+}
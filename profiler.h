@@ -0,0 +1,28 @@
+#pragma once
+
+#include <ostream>
+
+// In-backend sampling profiler. While armed, a CPU time timer delivers
+// SIGPROF at the requested frequency and the handler records a stack
+// sample into a preallocated ring. Symbolisation and aggregation
+// happen later, outside of the signal handler.
+
+// Arm the profiler, @frequency is in Hz.
+//
+// Returns: false if the timer couldn't be set up, check errno
+bool profiler_start(int frequency);
+
+// Disarm the profiler. Samples collected so far are retained.
+void profiler_stop();
+
+// Discard collected samples.
+void profiler_reset();
+
+bool profiler_has_samples();
+
+// Folded stacks, a line per distinct stack: "root;...;leaf count".
+// Feed to flamegraph.pl.
+void make_folded_report(std::ostream &os);
+
+// Legacy gperftools CPU profile format understood by pprof.
+void make_pprof_report(std::ostream &os);
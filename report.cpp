@@ -2,6 +2,11 @@
 #include "json.h"
 #include "symboliser.h"
 #include <dlfcn.h>
+#include <map>
+#include <unordered_map>
+#include <sstream>
+#include <cctype>
+#include <algorithm>
 
 extern "C" {
 #include "access/heapam.h"
@@ -13,19 +18,233 @@ extern "C" {
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
+#include "utils/inval.h"
+#include "catalog/pg_class.h"
 #include "miscadmin.h"
+#include "nodes/relation.h"
 }
 
 static void
-report_samples(std::ostream &os, const InstrumentationContext &ic)
+report_usage(std::ostream &os, const InstrumentationContext &ic,
+             const ResourceUsage &usage)
+{
+    os << "{\"time\":" << usage.time;
+    if (ic.memory)
+        os << ",\"memory\":" << usage.memory;
+    for (int i = 0; i < perf_counters_count() && ic.perf; i++)
+        os << ",\"" << perf_counters_name(i) << "\":" << usage.perf.value[i];
+    os << '}';
+}
+
+// Sibling appendrel members (partitions) whose RelOptInfo and paths
+// are identical but for relids, OIDs, rows and costs are folded: the first
+// one is reported in full, the others as per-member deltas. Folded
+// samples keep their entries, without node data, so that references
+// to them still resolve.
+struct FoldedGroup
+{
+    size_t                           rel; // Template, sample index
+    std::vector<size_t>              members; // Sample indexes
+};
+
+struct Folding
+{
+    std::vector<size_t>              templates; // By sample index, SIZE_MAX if not folded
+    std::vector<FoldedGroup>         groups;
+    std::unordered_map<const void *, std::vector<size_t>> paths; // By rel
+};
+
+static bool
+is_path_event(const char *event)
+{
+    return event && (strcmp(event, "add_path") == 0 ||
+                     strcmp(event, "add_partial_path") == 0);
+}
+
+// Fields sibling partitions differ in by nature: range table indexes,
+// OIDs, x-ids and estimates. Relid sets, "(b ...)", are too.
+static const char *const fold_fields[] = {
+    ":relid ", ":varno ", ":varnosyn ", ":varnoold ",
+    ":oid ", ":indexoid ", ":x-id ",
+    ":rows ", ":startup_cost ", ":total_cost ",
+    ":indextotalcost ", ":indexselectivity ",
+};
+
+// Node string with the values of fold_fields replaced by '#'. Any
+// other number, e.g. an attribute number, stays.
+static std::string
+fold_signature(const std::string &data)
+{
+    std::string res;
+    res.reserve(data.size());
+
+    for (size_t i = 0; i < data.size(); ) {
+
+        if (data.compare(i, 3, "(b ") == 0) {
+            const size_t end = data.find(')', i);
+            if (end == std::string::npos)
+                break;
+
+            res += "(b #)";
+            i = end + 1;
+            continue;
+        }
+
+        const char *field = nullptr;
+        if (data[i] == ':') {
+            for (const char *f: fold_fields) {
+                if (data.compare(i, strlen(f), f) == 0) {
+                    field = f;
+                    break;
+                }
+            }
+        }
+
+        if (!field) {
+            res += data[i++];
+            continue;
+        }
+
+        res += field;
+        res += '#';
+        i += strlen(field);
+        while (i < data.size() && data[i] != ' ' && data[i] != '}' &&
+               data[i] != ')')
+            i++;
+    }
+    return res;
+}
+
+// Value of a :field in a node string.
+static std::string
+node_field(const std::string &data, const char *name)
+{
+    auto pos = data.find(name);
+    if (pos == std::string::npos)
+        return "null";
+
+    pos += strlen(name);
+    auto end = data.find_first_of(" }", pos);
+    return data.substr(pos, end == std::string::npos ? end : end - pos);
+}
+
+static Folding
+fold_partitions(const InstrumentationContext &ic)
+{
+    Folding folding;
+    folding.templates.resize(ic.samples.size(), SIZE_MAX);
+
+    if (!ic.fold_partitions)
+        return folding;
+
+    for (size_t i = 0; i < ic.samples.size(); i++) {
+        const auto &object = ic.samples[i];
+        if (object.parent && is_path_event(object.event))
+            folding.paths[object.parent].push_back(i);
+    }
+
+    std::map<std::pair<const void *, std::string>, size_t> groups_index;
+    for (size_t i = 0; i < ic.samples.size(); i++) {
+
+        const auto &object = ic.samples[i];
+        if (!object.appendrel)
+            continue;
+
+        std::string signature = fold_signature(object.data);
+        for (size_t path: folding.paths[object.id])
+            signature += '\n' + fold_signature(ic.samples[path].data);
+
+        auto ins = groups_index.emplace(
+            std::make_pair(object.appendrel, std::move(signature)),
+            folding.groups.size());
+
+        if (ins.second) {
+            folding.groups.push_back(FoldedGroup{i, {}});
+            continue;
+        }
+
+        // Same signature, same paths in the same order.
+        auto &group = folding.groups[ins.first->second];
+        const auto &rel = ic.samples[group.rel];
+        const auto &paths = folding.paths[object.id];
+        const auto &template_paths = folding.paths[rel.id];
+
+        group.members.push_back(i);
+        folding.templates[i] = group.rel;
+        for (size_t k = 0; k < paths.size(); k++)
+            folding.templates[paths[k]] = template_paths[k];
+    }
+
+    folding.groups.erase(
+        std::remove_if(folding.groups.begin(), folding.groups.end(),
+                       [] (const auto &group) { return group.members.empty(); }),
+        folding.groups.end());
+
+    return folding;
+}
+
+static void
+report_folded(std::ostream &os, const InstrumentationContext &ic,
+              const Folding &folding)
 {
     const char *sep = "";
     os << '[';
-    for (const auto &object: ic.samples) {
+    for (const auto &group: folding.groups) {
+
+        const auto &rel = ic.samples[group.rel];
+        os << sep << "{\"template\":\"" << rel.id
+           << "\",\"appendrel\":\"" << rel.appendrel
+           << "\",\"members\":[";
+        sep = ",";
+
+        const char *msep = "";
+        for (size_t member: group.members) {
+
+            const auto &object = ic.samples[member];
+            os << msep << "{\"id\":\"" << object.id
+               << "\",\"oid\":" << object.oid
+               << ",\"rows\":" << node_field(object.data, ":rows ")
+               << ",\"paths\":[";
+            msep = ",";
+
+            const char *psep = "";
+            for (size_t path: folding.paths.at(object.id)) {
+
+                const auto &data = ic.samples[path].data;
+                os << psep << "{\"id\":\"" << ic.samples[path].id
+                   << "\",\"rows\":" << node_field(data, ":rows ")
+                   << ",\"startupCost\":" << node_field(data, ":startup_cost ")
+                   << ",\"totalCost\":" << node_field(data, ":total_cost ")
+                   << '}';
+                psep = ",";
+            }
+            os << "]}";
+        }
+        os << "]}";
+    }
+    os << ']';
+}
+
+static void
+report_samples(std::ostream &os, const InstrumentationContext &ic,
+               const Folding &folding)
+{
+    const char *sep = "";
+    os << '[';
+    for (size_t i = 0; i < ic.samples.size(); i++) {
+
+        const auto &object = ic.samples[i];
+        const size_t folded_to = folding.templates[i];
 
         os << sep; sep = ",";
         os << "{\"id\":\"" << object.id <<'"';
-        os << ",\"data\":\"" << json_escape_string(object.data) << '\"';
+
+        // Data is the template's, see "folded" for the numbers that
+        // differ.
+        if (folded_to != SIZE_MAX)
+            os << ",\"template\":\"" << ic.samples[folded_to].id << '"';
+        else
+            os << ",\"data\":\"" << json_escape_string(object.data) << '\"';
 
         if (object.oid != InvalidOid)
             os << ",\"oid\":" << object.oid;
@@ -36,7 +255,26 @@ report_samples(std::ostream &os, const InstrumentationContext &ic)
         if (object.parent)
             os << ",\"parent\":\"" << object.parent << '"';
 
-        if (!object.backtrace.empty()) {
+        if (object.appendrel)
+            os << ",\"appendrel\":\"" << object.appendrel << '"';
+
+        if (object.event)
+            os << ",\"event\":\"" << object.event << "\",\"timestamp\":"
+               << object.timestamp - ic.start_time;
+
+        if (!object.costs.empty())
+            os << ",\"costs\":" << object.costs;
+
+        auto usage = ic.usage.find(object.id);
+        if (usage != ic.usage.end()) {
+            os << ",\"usage\":";
+            report_usage(os, ic, usage->second);
+        }
+
+        // So is the backtrace, most likely.
+        if (!object.backtrace.empty() &&
+            (folded_to == SIZE_MAX ||
+             object.backtrace != ic.samples[folded_to].backtrace)) {
 
             os << ",\"backtrace\":[";
 
@@ -54,6 +292,96 @@ report_samples(std::ostream &os, const InstrumentationContext &ic)
     os << ']';
 }
 
+#if PG_VERSION_NUM < 110000 && !defined(TupleDescAttr)
+#define TupleDescAttr(tupdesc, i) ((tupdesc)->attrs[(i)])
+#endif
+
+// Rendered JSON of relations, types, functions and operators, kept
+// across reports until the catalog entries are invalidated. Syscache
+// invalidations only carry a hash value, hence it is kept alongside.
+struct CachedFragment
+{
+    uint32                    hashvalue;
+    std::string               json;
+};
+
+using FragmentCache = std::unordered_map<Oid, CachedFragment>;
+
+static std::unordered_map<Oid, std::string> relation_fragments;
+static FragmentCache type_fragments;
+static FragmentCache function_fragments;
+static FragmentCache operator_fragments;
+
+static void
+invalidate_relation_fragment(Datum arg, Oid relid)
+{
+    if (relid == InvalidOid)
+        relation_fragments.clear();
+    else
+        relation_fragments.erase(relid);
+}
+
+// Relation fragments include the namespace name.
+static void
+invalidate_namespace(Datum arg, int cacheid, uint32 hashvalue)
+{
+    relation_fragments.clear();
+}
+
+static void
+invalidate_fragments(Datum arg, int cacheid, uint32 hashvalue)
+{
+    auto &cache = *reinterpret_cast<FragmentCache *>(DatumGetPointer(arg));
+
+    if (hashvalue == 0) {
+        cache.clear();
+        return;
+    }
+
+    for (auto it = cache.begin(); it != cache.end(); ) {
+        if (it->second.hashvalue == hashvalue)
+            it = cache.erase(it);
+        else
+            ++it;
+    }
+}
+
+void report_cache_init()
+{
+    CacheRegisterRelcacheCallback(invalidate_relation_fragment, 0);
+    CacheRegisterSyscacheCallback(NAMESPACEOID, invalidate_namespace, 0);
+    CacheRegisterSyscacheCallback(TYPEOID, invalidate_fragments,
+                                  PointerGetDatum(&type_fragments));
+    CacheRegisterSyscacheCallback(PROCOID, invalidate_fragments,
+                                  PointerGetDatum(&function_fragments));
+    CacheRegisterSyscacheCallback(OPEROID, invalidate_fragments,
+                                  PointerGetDatum(&operator_fragments));
+}
+
+static std::string
+render_relation(Oid oid)
+{
+    std::ostringstream os;
+    Relation rel = heap_open(oid, NoLock);
+    TupleDesc desc = RelationGetDescr(rel);
+
+    os << "{\"oid\":" << oid;
+    os << ",\"name\":\"" << json_escape_string(RelationGetRelationName(rel));
+    os << "\",\"ns\":\"" << json_escape_string(get_namespace_name(
+                                                 RelationGetNamespace(rel)));
+    os << "\",\"attrs\":[";
+
+    for (int i = 0; i < desc->natts; i++) {
+
+        if (i != 0) os << ",";
+        os << '"' << json_escape_string(NameStr(TupleDescAttr(desc, i)->attname)) << '"';
+    }
+    os << "]}";
+
+    heap_close(rel, NoLock);
+    return os.str();
+}
+
 static void
 report_relations(std::ostream &os, const InstrumentationContext &ic)
 {
@@ -68,28 +396,25 @@ report_relations(std::ostream &os, const InstrumentationContext &ic)
 
         if (oid == InvalidOid) continue;
 
-        os << sep << "{\"oid\":" << oid; sep = ",";
-
-        Relation rel = heap_open(oid, NoLock);
-
-        os << ",\"name\":\"" << json_escape_string(RelationGetRelationName(rel));
-        os << "\",\"ns\":\"" << json_escape_string(get_namespace_name(
-                                                     RelationGetNamespace(rel)));
-        os << "\",\"attrs\":[";
+        auto it = relation_fragments.find(oid);
+        if (it == relation_fragments.end())
+            it = relation_fragments.emplace(oid, render_relation(oid)).first;
 
-        const int n = RelationGetDescr(rel)->natts;
-        for (int i = 1; i <= n; i++) {
-
-            if (i != 1) os << ",";
-            os << '"' << json_escape_string(get_relid_attribute_name(oid, i)) << '"';
-        }
-        os << "]}";
-
-        heap_close(rel, NoLock);
+        os << sep << it->second; sep = ",";
     }
     os << ']';
 }
 
+std::string module_path(const char *dli_fname)
+{
+    // Postgres clobbers argv, hence a funny path for the main
+    // executable
+    if (strncmp(dli_fname, "postgres: ", 10) == 0)
+        return my_exec_path;
+
+    return dli_fname;
+}
+
 struct ModuleInfo
 {
     std::string               name;
@@ -116,14 +441,8 @@ report_modules(std::ostream &os, const InstrumentationContext &ic)
 
         auto &mi = modules[dlinfo.dli_fbase];
 
-        if (mi.name.empty()) {
-            // Postgres clobbers argv, hence a funny path for the main
-            // executable
-            if (strncmp(dlinfo.dli_fname, "postgres: ", 10) == 0)
-                mi.name = my_exec_path;
-            else
-                mi.name = dlinfo.dli_fname;
-        }
+        if (mi.name.empty())
+            mi.name = module_path(dlinfo.dli_fname);
 
         mi.stack_frames.push_back(frame);
     }
@@ -170,22 +489,41 @@ template<SysCacheIdentifier EntityId,
 static void
 report_entities(std::ostream &os,
                 const std::unordered_set<Oid> &oids,
+                FragmentCache &cache,
                 const Callback &callback)
 {
     os << '[';
     const char *sep = "";
     for (auto oid: oids) {
 
-        os << sep << "{\"oid\":" << oid; sep = ",";
+        os << sep; sep = ",";
+
+        auto it = cache.find(oid);
+        if (it != cache.end()) {
+            os << it->second.json;
+            continue;
+        }
+
+        std::ostringstream entity;
+        entity << "{\"oid\":" << oid;
 
         HeapTuple tuple = SearchSysCache1(EntityId, ObjectIdGetDatum(oid));
 
         if (HeapTupleIsValid(tuple)) {
-            callback(*reinterpret_cast<const Entity>(GETSTRUCT(tuple)));
+            callback(entity,
+                     *reinterpret_cast<const Entity>(GETSTRUCT(tuple)));
             ReleaseSysCache(tuple);
         }
 
-        os << '}';
+        entity << '}';
+
+        if (HeapTupleIsValid(tuple)) {
+            uint32 hashvalue = GetSysCacheHashValue1(EntityId,
+                                                     ObjectIdGetDatum(oid));
+            cache.emplace(oid, CachedFragment{hashvalue, entity.str()});
+        }
+
+        os << entity.str();
     }
     os << ']';
 }
@@ -193,31 +531,525 @@ report_entities(std::ostream &os,
 static void
 report_types(std::ostream &os, const InstrumentationContext &ic)
 {
-    report_entities<TYPEOID, Form_pg_type>(os, ic.types, [&] (auto &type) {
-        os << ",\"name\":\"" << json_escape_string(NameStr(type.typname)) << '"';
+    report_entities<TYPEOID, Form_pg_type>(os, ic.types, type_fragments,
+                                           [] (auto &entity, auto &type) {
+        entity << ",\"name\":\"" << json_escape_string(NameStr(type.typname)) << '"';
     });
 }
 
 static void
 report_functions(std::ostream &os, const InstrumentationContext &ic)
 {
-    report_entities<PROCOID, Form_pg_proc>(os, ic.functions, [&] (auto &proc) {
-        os << ",\"name\":\"" << json_escape_string(NameStr(proc.proname)) << '"';
+    report_entities<PROCOID, Form_pg_proc>(os, ic.functions, function_fragments,
+                                           [] (auto &entity, auto &proc) {
+        entity << ",\"name\":\"" << json_escape_string(NameStr(proc.proname)) << '"';
     });
 }
 
 static void
 report_operators(std::ostream &os, const InstrumentationContext &ic)
 {
-    report_entities<OPEROID, Form_pg_operator>(os, ic.operators, [&] (auto &oper) {
-        os << ",\"name\":\"" << json_escape_string(NameStr(oper.oprname)) << '"';
+    report_entities<OPEROID, Form_pg_operator>(os, ic.operators, operator_fragments,
+                                               [] (auto &entity, auto &oper) {
+        entity << ",\"name\":\"" << json_escape_string(NameStr(oper.oprname)) << '"';
     });
 }
 
+static void
+report_phases(std::ostream &os, const InstrumentationContext &ic)
+{
+    const char *sep = "";
+    os << '[';
+    for (const auto &phase: ic.phases) {
+
+        os << sep; sep = ",";
+        os << "{\"name\":\"" << phase.name << '"';
+
+        if (phase.root)
+            os << ",\"root\":\"" << phase.root << '"';
+
+        os << ",\"begin\":" << phase.begin - ic.start_time;
+        if (phase.end) {
+            os << ",\"end\":" << phase.end - ic.start_time;
+            os << ",\"usage\":";
+            report_usage(os, ic, phase.usage);
+        }
+        os << '}';
+    }
+    os << ']';
+}
+
+// The explored join lattice: join_search_one_level() invocations and
+// the join rels built, by relids.
+static void
+report_join_search(std::ostream &os, const InstrumentationContext &ic)
+{
+    const char *sep = "";
+    os << "{\"levels\":[";
+    for (const auto &level: ic.join_levels) {
+
+        const auto &phase = ic.phases[level.phase];
+
+        os << sep << "{\"root\":\"" << level.root << "\",\"level\":"
+           << level.level << ",\"pairs\":" << level.pairs_tried
+           << ",\"rels\":" << level.rels_built << ",\"time\":";
+
+        // Unfinished when join_search_one_level() threw
+        if (phase.end)
+            os << phase.end - phase.begin;
+        else
+            os << "null";
+
+        os << '}';
+        sep = ",";
+    }
+
+    sep = "";
+    os << "],\"rels\":[";
+    for (const auto &rel: ic.join_rels) {
+
+        os << sep << "{\"id\":\"" << rel.rel << "\",\"root\":\"" << rel.root
+           << "\",\"relids\":\"" << rel.relids << "\",\"level\":" << rel.level
+           << ",\"pairs\":" << rel.pairs << '}';
+        sep = ",";
+    }
+    os << "]}";
+}
+
+static const char *
+upper_rel_kind_name(int kind)
+{
+    switch (kind) {
+    case UPPERREL_SETOP:             return "setop";
+#if PG_VERSION_NUM >= 110000
+    case UPPERREL_PARTIAL_GROUP_AGG: return "partial_group_agg";
+#endif
+    case UPPERREL_GROUP_AGG:         return "group_agg";
+    case UPPERREL_WINDOW:            return "window";
+    case UPPERREL_DISTINCT:          return "distinct";
+    case UPPERREL_ORDERED:           return "ordered";
+    case UPPERREL_FINAL:             return "final";
+    default:                         return "unknown";
+    }
+}
+
+// Upper rels linked to their input rels, followed by per stage totals.
+// Time is what was charged to the stage's rels.
+static void
+report_upper_rels(std::ostream &os, const InstrumentationContext &ic)
+{
+    struct Stage { size_t rels = 0, paths = 0, partial_paths = 0; uint64_t time = 0; };
+    std::map<int, Stage> stages;
+
+    const char *sep = "";
+    os << "{\"rels\":[";
+    for (const auto &upper: ic.upper_rels) {
+
+        os << sep << "{\"id\":\"" << upper.rel << "\",\"root\":\"" << upper.root
+           << "\",\"kind\":\"" << upper_rel_kind_name(upper.kind) << '"';
+        sep = ",";
+
+        if (upper.input)
+            os << ",\"input\":\"" << upper.input << '"';
+
+        os << ",\"paths\":" << upper.paths
+           << ",\"partialPaths\":" << upper.partial_paths << '}';
+
+        auto &stage = stages[upper.kind];
+        stage.rels++;
+        stage.paths += upper.paths;
+        stage.partial_paths += upper.partial_paths;
+
+        auto usage = ic.usage.find(upper.rel);
+        if (usage != ic.usage.end())
+            stage.time += usage->second.time;
+    }
+
+    sep = "";
+    os << "],\"stages\":[";
+    for (const auto &item: stages) {
+
+        const auto &stage = item.second;
+
+        os << sep << "{\"kind\":\"" << upper_rel_kind_name(item.first)
+           << "\",\"rels\":" << stage.rels << ",\"paths\":" << stage.paths
+           << ",\"partialPaths\":" << stage.partial_paths
+           << ",\"time\":" << stage.time << '}';
+        sep = ",";
+    }
+    os << "]}";
+}
+
+static void
+report_dominance(std::ostream &os, const InstrumentationContext &ic)
+{
+    const char *sep = "";
+    os << '[';
+    for (const auto &edge: ic.dominance) {
+
+        os << sep << "{\"winner\":";
+        if (edge.winner)
+            os << '"' << edge.winner << '"';
+        else
+            os << "null";
+        os << ",\"loser\":\"" << edge.loser << "\",\"fate\":\"" << edge.fate
+           << "\",\"reason\":\"" << edge.reason << '"';
+        sep = ",";
+
+        if (edge.partial)
+            os << ",\"partial\":true";
+        os << '}';
+    }
+    os << ']';
+}
+
+// Row estimates of rels and the clause selectivities behind them.
+static void
+report_estimates(std::ostream &os, const InstrumentationContext &ic)
+{
+    static const std::pair<unsigned, const char *> source_names[] =
+    {
+        {STATS_SOURCE_MCV,       "mcv"},
+        {STATS_SOURCE_HISTOGRAM, "histogram"},
+        {STATS_SOURCE_OTHER,     "other"},
+        {STATS_SOURCE_NDISTINCT, "ndistinct"},
+        {STATS_SOURCE_DEFAULT,   "default"},
+    };
+
+    const char *sep = "";
+    os << "{\"rels\":[";
+    for (const auto &estimate: ic.rel_estimates) {
+
+        os << sep << "{\"id\":\"" << estimate.rel << "\",\"rows\":"
+           << estimate.rows << ",\"time\":" << estimate.time << '}';
+        sep = ",";
+    }
+
+    sep = "";
+    os << "],\"clauses\":[";
+    for (const auto &estimate: ic.clause_estimates) {
+
+        os << sep << "{\"clause\":\"" << estimate.clause << '"';
+        sep = ",";
+
+        if (estimate.rel)
+            os << ",\"rel\":\"" << estimate.rel << '"';
+
+        os << ",\"varRelid\":" << estimate.var_relid
+           << ",\"jointype\":" << estimate.jointype
+           << ",\"selectivity\":" << estimate.selectivity
+           << ",\"calls\":" << estimate.calls
+           << ",\"time\":" << estimate.time
+           << ",\"sources\":[";
+
+        // No statistics consulted: a hardwired default selectivity.
+        if (!estimate.sources)
+            os << "\"default\"";
+
+        const char *ssep = "";
+        for (const auto &source: source_names) {
+            if (estimate.sources & source.first) {
+                os << ssep << '"' << source.second << '"';
+                ssep = ",";
+            }
+        }
+        os << "]}";
+    }
+
+    os << "],\"clauselists\":{\"calls\":" << ic.clauselist_calls
+       << ",\"time\":" << ic.clauselist_time << "}}";
+}
+
+static void
+report_geqo(std::ostream &os, const InstrumentationContext &ic)
+{
+    const char *sep = "";
+    os << '[';
+    for (const auto &run: ic.geqo_runs) {
+
+        os << sep << "{\"root\":\"" << run.root << "\",\"rels\":" << run.rels
+           << ",\"generations\":[";
+        sep = ",";
+
+        const char *gsep = "";
+        for (const auto &generation: run.generations) {
+
+            os << gsep << "{\"evaluated\":" << generation.evaluated
+               << ",\"best\":" << generation.best
+               << ",\"worst\":" << generation.worst
+               << ",\"poolBest\":" << generation.pool_best
+               << ",\"poolWorst\":" << generation.pool_worst
+               << ",\"time\":" << (generation.end ? generation.end - generation.begin : 0)
+               << '}';
+            gsep = ",";
+        }
+        os << "]}";
+    }
+    os << ']';
+}
+
+static void
+report_catalog_access(std::ostream &os, const CatalogAccess &access)
+{
+    os << "\"lookups\":" << access.lookups
+       << ",\"misses\":" << access.misses
+       << ",\"time\":" << access.time;
+}
+
+// Syscaches by time spent, relcache totals, catalogs scanned directly
+// and the relations whose planning did the most catalog work.
+static void
+report_catalog(std::ostream &os, const InstrumentationContext &ic)
+{
+    constexpr size_t TOP_MAX = 20;
+    const auto by_time = [] (const auto &a, const auto &b) {
+        return a.second->time > b.second->time;
+    };
+
+    std::vector<std::pair<int, const CatalogAccess *>> syscaches;
+    for (const auto &syscache: ic.syscaches)
+        syscaches.emplace_back(syscache.first, &syscache.second.access);
+    std::sort(syscaches.begin(), syscaches.end(), by_time);
+
+    const char *sep = "";
+    os << "{\"syscaches\":[";
+    for (const auto &syscache: syscaches) {
+
+        os << sep << "{\"id\":" << syscache.first << ",\"catalog\":\""
+           << json_escape_string(ic.syscaches.at(syscache.first).catalog)
+           << "\",";
+        report_catalog_access(os, *syscache.second);
+        os << '}'; sep = ",";
+    }
+
+    os << "],\"relcache\":{";
+    report_catalog_access(os, ic.relcache);
+
+    sep = "";
+    os << "},\"scans\":[";
+    for (const auto &scans: ic.catalog_scans) {
+
+        const char *name = get_rel_name(scans.first);
+        os << sep << "{\"oid\":" << scans.first << ",\"catalog\":\""
+           << json_escape_string(name ? name : "") << "\",\"scans\":"
+           << scans.second << '}';
+        sep = ",";
+    }
+
+    // InvalidOid collects access not made on behalf of a relation.
+    std::vector<std::pair<Oid, const CatalogAccess *>> relations;
+    for (const auto &relation: ic.catalog_by_relation)
+        relations.emplace_back(relation.first, &relation.second);
+    std::sort(relations.begin(), relations.end(), by_time);
+    relations.resize(std::min(relations.size(), TOP_MAX));
+
+    sep = "";
+    os << "],\"relations\":[";
+    for (const auto &relation: relations) {
+
+        os << sep << "{\"oid\":" << relation.first << ',';
+        report_catalog_access(os, *relation.second);
+        os << '}'; sep = ",";
+    }
+    os << "]}";
+}
+
+static void
+report_partition_pruning(std::ostream &os, const InstrumentationContext &ic)
+{
+    const char *sep = "";
+    os << '[';
+    for (const auto &pruning: ic.partition_pruning) {
+
+        os << sep << "{\"rel\":\"" << pruning.rel
+           << "\",\"root\":\"" << pruning.root
+           << "\",\"oid\":" << pruning.oid
+           << ",\"method\":\"" << pruning.method
+           << "\",\"partitions\":" << pruning.partitions
+           << ",\"pruned\":" << pruning.pruned
+           << ",\"time\":" << pruning.time
+           << ",\"runtime\":" << (pruning.runtime ? "true" : "false")
+           << ",\"quals\":[";
+        sep = ",";
+
+        const char *qsep = "";
+        for (const void *qual: pruning.quals) {
+            os << qsep << '"' << qual << '"';
+            qsep = ",";
+        }
+        os << "]}";
+    }
+    os << ']';
+}
+
+static const char *
+relkind_name(char relkind)
+{
+    switch (relkind) {
+    case RELKIND_RELATION:          return "table";
+    case RELKIND_INDEX:             return "index";
+    case RELKIND_SEQUENCE:          return "sequence";
+    case RELKIND_TOASTVALUE:        return "toast";
+    case RELKIND_VIEW:              return "view";
+    case RELKIND_MATVIEW:           return "matview";
+    case RELKIND_COMPOSITE_TYPE:    return "composite";
+    case RELKIND_FOREIGN_TABLE:     return "foreign";
+#if PG_VERSION_NUM >= 100000
+    case RELKIND_PARTITIONED_TABLE: return "partitioned";
+#endif
+#if PG_VERSION_NUM >= 110000
+    case RELKIND_PARTITIONED_INDEX: return "partitionedIndex";
+#endif
+    default:                        return "other";
+    }
+}
+
+// Locks by relation kind, resolved now rather than in the lock hook.
+static std::map<std::string, LockAcquisitions>
+locks_by_kind(const InstrumentationContext &ic)
+{
+    std::map<std::string, LockAcquisitions> kinds;
+
+    for (const auto &locks: ic.locks_by_relation)
+        kinds[relkind_name(get_rel_relkind(locks.first))] += locks.second;
+    if (ic.other_locks.locks || ic.other_locks.already_held)
+        kinds["nonRelation"] += ic.other_locks;
+
+    return kinds;
+}
+
+static void
+report_lock_acquisitions(std::ostream &os, const LockAcquisitions &locks)
+{
+    os << "\"locks\":" << locks.locks
+       << ",\"fastPath\":" << locks.fast_path
+       << ",\"mainTable\":" << locks.locks - locks.fast_path
+       << ",\"alreadyHeld\":" << locks.already_held
+       << ",\"time\":" << locks.time;
+}
+
+static void
+report_locks(std::ostream &os, const InstrumentationContext &ic)
+{
+    LockAcquisitions total;
+    const char *sep = "";
+
+    os << "{\"kinds\":[";
+    for (const auto &kind: locks_by_kind(ic)) {
+
+        os << sep << "{\"kind\":\"" << kind.first << "\",";
+        report_lock_acquisitions(os, kind.second);
+        os << '}'; sep = ",";
+        total += kind.second;
+    }
+    os << "],\"relations\":" << ic.locks_by_relation.size()
+       << ",\"total\":{";
+    report_lock_acquisitions(os, total);
+    os << "}}";
+}
+
+// Counters in use and the total consumed during capture.
+static void
+report_perf(std::ostream &os, const InstrumentationContext &ic)
+{
+    if (!ic.perf) {
+        os << "null";
+        return;
+    }
+
+    os << "{\"source\":\"" << perf_counters_source() << "\",\"events\":[";
+    for (int i = 0; i < perf_counters_count(); i++)
+        os << (i ? ",\"" : "\"") << perf_counters_name(i) << '"';
+    os << "],\"total\":";
+    report_usage(os, ic, ic.last_reading - ic.first_reading);
+    os << '}';
+}
+
+// RelOptInfo-s whose path generation allocated the most, descending.
+static void
+report_memory_top(std::ostream &os, const InstrumentationContext &ic)
+{
+    constexpr size_t TOP_MAX = 20;
+    std::vector<std::pair<int64_t, const PgObject *>> rels;
+
+    for (const auto &usage: ic.usage) {
+
+        auto it = ic.samples_index.find(usage.first);
+        if (it == ic.samples_index.end() || usage.second.memory <= 0)
+            continue;
+
+        // Usage is charged to PlannerInfo-s as well.
+        const auto &object = ic.samples[it->second];
+        if (object.data.compare(0, 11, "{RELOPTINFO") == 0)
+            rels.emplace_back(usage.second.memory, &object);
+    }
+
+    std::sort(rels.begin(), rels.end(),
+              [] (const auto &a, const auto &b) { return a.first > b.first; });
+    rels.resize(std::min(rels.size(), TOP_MAX));
+
+    const char *sep = "";
+    os << '[';
+    for (const auto &rel: rels) {
+
+        os << sep << "{\"id\":\"" << rel.second->id << "\",\"memory\":"
+           << rel.first; sep = ",";
+        if (rel.second->oid != InvalidOid)
+            os << ",\"oid\":" << rel.second->oid;
+        os << '}';
+    }
+    os << ']';
+}
+
 void make_report(std::ostream &os, const InstrumentationContext &ic)
 {
-    os << "{\"samples\":";
-    report_samples(os, ic);
+    os << "{\"perf\":";
+    report_perf(os, ic);
+
+    os << ",\"captureOverhead\":";
+    report_usage(os, ic, ic.overhead);
+
+    const Folding folding = fold_partitions(ic);
+
+    os << ",\"samples\":";
+    report_samples(os, ic, folding);
+
+    os << ",\"folded\":";
+    report_folded(os, ic, folding);
+
+    os << ",\"phases\":";
+    report_phases(os, ic);
+
+    os << ",\"joinSearch\":";
+    report_join_search(os, ic);
+
+    os << ",\"upperRels\":";
+    report_upper_rels(os, ic);
+
+    if (ic.dominance_enabled) {
+        os << ",\"dominance\":";
+        report_dominance(os, ic);
+    }
+
+    os << ",\"estimates\":";
+    report_estimates(os, ic);
+
+    os << ",\"geqo\":";
+    report_geqo(os, ic);
+
+    os << ",\"catalog\":";
+    report_catalog(os, ic);
+
+    os << ",\"partitionPruning\":";
+    report_partition_pruning(os, ic);
+
+    os << ",\"locks\":";
+    report_locks(os, ic);
+
+    if (ic.memory) {
+        os << ",\"memoryTop\":";
+        report_memory_top(os, ic);
+    }
 
     os << ",\"relations\":";
     report_relations(os, ic);
@@ -236,3 +1068,139 @@ void make_report(std::ostream &os, const InstrumentationContext &ic)
 
     os << '}';
 }
+
+std::vector<std::pair<std::string, std::string>>
+make_counters(const InstrumentationContext &ic)
+{
+    std::vector<std::pair<std::string, std::string>> counters;
+    const auto add = [&] (std::string name, auto value) {
+        counters.emplace_back("Planscape " + name, std::to_string(value));
+    };
+
+    size_t paths = 0;
+    for (const auto &object: ic.samples)
+        paths += is_path_event(object.event);
+
+    add("Paths", paths);
+    add("Join Rels", ic.join_rels.size());
+
+    CatalogAccess syscache;
+    for (const auto &cache: ic.syscaches) {
+        syscache.lookups += cache.second.access.lookups;
+        syscache.misses += cache.second.access.misses;
+    }
+    add("Syscache Lookups", syscache.lookups);
+    add("Syscache Misses", syscache.misses);
+    add("Relcache Misses", ic.relcache.misses);
+
+    LockAcquisitions total;
+    for (const auto &kind: locks_by_kind(ic)) {
+        add("Locks (" + kind.first + ")", kind.second.locks);
+        total += kind.second;
+    }
+    add("Locks", total.locks);
+    add("Fast-Path Locks", total.fast_path);
+    add("Lock Time (us)", total.time / 1000);
+
+    return counters;
+}
+
+// Trace-event timestamps and durations are in microseconds.
+static std::string
+trace_us(uint64_t ns)
+{
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.3f", ns / 1000.0);
+    return buf;
+}
+
+// Time span covered by the events related to a RelOptInfo: the rel
+// itself was built and paths were added to it.
+struct RelSpan
+{
+    uint64_t begin = UINT64_MAX;
+    uint64_t end = 0;
+    Oid      oid = InvalidOid;
+
+    void extend(uint64_t t)
+    {
+        begin = std::min(begin, t);
+        end = std::max(end, t);
+    }
+};
+
+// Chrome trace-event format, load into chrome://tracing or Perfetto.
+// Phases become complete events, hook invocations become instant
+// events and every RelOptInfo gets an async span from its creation to
+// the last path added.
+void make_trace_report(std::ostream &os, const InstrumentationContext &ic)
+{
+    const int pid = MyProcPid;
+    const char *sep = ",";
+
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+       << ",\"args\":{\"name\":\"planscape\"}}";
+
+    for (const auto &phase: ic.phases) {
+
+        if (!phase.end) continue;
+
+        os << sep << "{\"name\":\"" << phase.name << "\",\"cat\":\"phase\""
+           << ",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << pid
+           << ",\"ts\":" << trace_us(phase.begin - ic.start_time)
+           << ",\"dur\":" << trace_us(phase.end - phase.begin)
+           << ",\"args\":{\"root\":\"" << phase.root << "\",\"usage\":";
+        report_usage(os, ic, phase.usage);
+        os << "}}";
+    }
+
+    std::map<const void *, RelSpan> rels;
+
+    for (const auto &object: ic.samples) {
+
+        if (!object.event) continue;
+
+        os << sep << "{\"name\":\"" << object.event << "\",\"cat\":\"capture\""
+           << ",\"ph\":\"i\",\"s\":\"t\",\"pid\":" << pid << ",\"tid\":" << pid
+           << ",\"ts\":" << trace_us(object.timestamp - ic.start_time)
+           << ",\"args\":{\"id\":\"" << object.id << '"';
+        if (object.parent)
+            os << ",\"parent\":\"" << object.parent << '"';
+
+        if (object.appendrel)
+            os << ",\"appendrel\":\"" << object.appendrel << '"';
+        os << "}}";
+
+        // Paths (having a backtrace) extend the span of the parent
+        // rel, rels start their own.
+        auto &span = rels[object.backtrace.empty() ? object.id : object.parent];
+        span.extend(object.timestamp);
+        if (object.oid != InvalidOid)
+            span.oid = object.oid;
+    }
+
+    for (const auto &item: rels) {
+
+        const auto &span = item.second;
+        const char *relname = span.oid != InvalidOid ? get_rel_name(span.oid)
+                                                     : nullptr;
+        std::ostringstream name;
+
+        if (relname)
+            name << relname;
+        else
+            name << "RelOptInfo " << item.first;
+
+        for (auto ph: {'b', 'e'}) {
+            os << sep << "{\"name\":\"" << json_escape_string(name.str())
+               << "\",\"cat\":\"rel\",\"ph\":\"" << ph
+               << "\",\"id\":\"" << item.first << "\",\"pid\":" << pid
+               << ",\"tid\":" << pid
+               << ",\"ts\":" << trace_us((ph == 'b' ? span.begin : span.end) - ic.start_time)
+               << '}';
+        }
+    }
+
+    os << "]}";
+}
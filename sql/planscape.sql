@@ -0,0 +1,86 @@
+-- Planner memory attribution on a many-partition table
+LOAD 'planscape';
+SET planscape.track_memory = on;
+-- Declarative partitioning needs 10, 9.6 gets inheritance children
+DO $$
+DECLARE
+    partitioned boolean := current_setting('server_version_num')::int >= 100000;
+BEGIN
+    EXECUTE 'CREATE TABLE measurements (id int, v int)'
+            || CASE WHEN partitioned THEN ' PARTITION BY RANGE (id)' ELSE '' END;
+    FOR i IN 0..63 LOOP
+        IF partitioned THEN
+            EXECUTE format('CREATE TABLE measurements_%s PARTITION OF measurements '
+                           'FOR VALUES FROM (%s) TO (%s)', i, i * 100, (i + 1) * 100);
+        ELSE
+            EXECUTE format('CREATE TABLE measurements_%s (CHECK (id >= %s AND id < %s)) '
+                           'INHERITS (measurements)', i, i * 100, (i + 1) * 100);
+        END IF;
+    END LOOP;
+END $$;
+-- Capture @query, return the report
+CREATE FUNCTION planscape_report(query text) RETURNS jsonb AS $$
+DECLARE
+    plan json;
+    report text;
+BEGIN
+    EXECUTE 'EXPLAIN (PLANSCAPE, FORMAT JSON, COSTS OFF) ' || query INTO plan;
+    CREATE TEMP TABLE report_lines (line text);
+    EXECUTE format('COPY report_lines FROM %L (FORMAT csv, QUOTE E''\x01'', DELIMITER E''\x02'')',
+                   plan->0->>'Planscape URL');
+    SELECT string_agg(line, E'\n') INTO report FROM report_lines;
+    DROP TABLE report_lines;
+    RETURN report::jsonb;
+END $$ LANGUAGE plpgsql;
+CREATE TEMP TABLE report AS
+    SELECT planscape_report('SELECT * FROM measurements WHERE v > 0') AS r;
+CREATE TEMP VIEW memory_top AS
+    SELECT e.ordinality AS rank, (e.value->>'memory')::int8 AS memory,
+           (e.value->>'oid')::oid AS oid
+    FROM report, jsonb_array_elements(r->'memoryTop') WITH ORDINALITY AS e;
+CREATE TEMP VIEW partitions AS
+    SELECT inhrelid AS oid FROM pg_inherits
+    WHERE inhparent = 'measurements'::regclass;
+-- Relations whose path generation allocated the most, descending
+SELECT count(*) > 0 AS has_memory_top,
+       bool_and(memory > 0) AS all_grew,
+       bool_and(memory <= (SELECT memory FROM memory_top p
+                           WHERE p.rank = t.rank - 1)) AS descending
+FROM memory_top t;
+-- Partitions are charged what was allocated for them, not the parent
+SELECT count(*) > 1 AS partitions_charged
+FROM memory_top WHERE oid IN (SELECT oid FROM partitions);
+SELECT bool_and(oid = 'measurements'::regclass OR
+                oid IN (SELECT oid FROM partitions)) AS only_measurements
+FROM memory_top WHERE oid IS NOT NULL;
+-- Growth is reported per phase and on RelOptInfo samples
+SELECT bool_or((p->'usage'->>'memory')::int8 > 0) AS phases_grew
+FROM report, jsonb_array_elements(r->'phases') AS p;
+SELECT count(*) > 1 AS rels_grew
+FROM report, jsonb_array_elements(r->'samples') AS s
+WHERE s->>'data' LIKE '{RELOPTINFO%' AND (s->'usage'->>'memory')::int8 > 0;
+-- Folded partitions still resolve
+SELECT bool_and(EXISTS (SELECT FROM report, jsonb_array_elements(r->'samples') AS s
+                        WHERE s->>'id' = e->>'id')) AS memory_top_resolves
+FROM report, jsonb_array_elements(r->'memoryTop') AS e;
+-- Every section is reported
+SELECT r ?& array['folded', 'joinSearch', 'upperRels', 'estimates',
+                  'catalog', 'locks'] AS has_sections
+FROM report;
+SELECT jsonb_array_length(r->'folded') > 0 AS partitions_folded,
+       jsonb_array_length(r->'upperRels'->'rels') > 0 AS has_upper_rels,
+       jsonb_array_length(r->'estimates'->'clauses') > 0 AS clauses_estimated,
+       jsonb_array_length(r->'catalog'->'syscaches') > 0 AS syscaches_used,
+       (r->'locks'->'total'->>'locks')::int8 > 0 AS locks_taken
+FROM report;
+CREATE TEMP TABLE join_report AS
+    SELECT planscape_report('SELECT * FROM measurements a JOIN measurements b USING (id)') AS r;
+SELECT jsonb_array_length(r->'joinSearch'->'levels') > 0 AS has_join_levels,
+       jsonb_array_length(r->'joinSearch'->'rels') > 0 AS has_join_rels
+FROM join_report;
+DROP VIEW memory_top, partitions;
+-- Inheritance children need CASCADE, don't list them
+SET client_min_messages = warning;
+DROP TABLE report, join_report, measurements CASCADE;
+RESET client_min_messages;
+DROP FUNCTION planscape_report(text);
@@ -0,0 +1,254 @@
+extern "C" {
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/hsearch.h"
+
+}
+
+#include "stats.h"
+
+#include <algorithm>
+
+namespace {
+
+struct StatsKey
+{
+    Oid         dbid;
+    uint64      queryid;
+};
+
+struct StatsHashEntry
+{
+    StatsKey    key; // Must come first
+    slock_t     mutex; // Protects the counters
+    int64       plans;
+    double      total_time;
+    double      max_time;
+    int64       paths;
+    int64       join_rels;
+    int64       captures;
+    double      capture_time;
+    double      usage; // Eviction priority, see entry_dealloc()
+};
+
+// Hash lock: shared to look entries up and update them (under the
+// entry's spinlock), exclusive to add or remove entries.
+struct StatsShared
+{
+    LWLock     *lock;
+};
+
+// Usage of a new entry, and added by every plan.
+constexpr double USAGE_PLAN = 1.0;
+
+// Usage decays by this factor on every eviction.
+constexpr double USAGE_DECREASE_FACTOR = 0.99;
+
+// Percentage of entries evicted when the hash is full.
+constexpr int    USAGE_DEALLOC_PERCENT = 5;
+
+}
+
+static int          max_entries;
+static StatsShared *shared = nullptr;
+static HTAB        *hash = nullptr;
+
+void stats_request(int max)
+{
+    max_entries = max;
+    RequestAddinShmemSpace(MAXALIGN(sizeof(StatsShared))
+                           + hash_estimate_size(max_entries,
+                                                sizeof(StatsHashEntry)));
+    RequestNamedLWLockTranche("planscape", 1);
+}
+
+void stats_startup()
+{
+    bool    found;
+    HASHCTL info;
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    shared = static_cast<StatsShared *>(
+        ShmemInitStruct("planscape", sizeof(StatsShared), &found));
+    if (!found)
+        shared->lock = &(GetNamedLWLockTranche("planscape"))->lock;
+
+    memset(&info, 0, sizeof info);
+    info.keysize = sizeof(StatsKey);
+    info.entrysize = sizeof(StatsHashEntry);
+    hash = ShmemInitHash("planscape hash", max_entries, max_entries,
+                         &info, HASH_ELEM | HASH_BLOBS);
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+bool stats_available()
+{
+    return shared && hash;
+}
+
+static int entry_cmp(const void *lhs, const void *rhs)
+{
+    const double l = (*static_cast<StatsHashEntry * const *>(lhs))->usage;
+    const double r = (*static_cast<StatsHashEntry * const *>(rhs))->usage;
+
+    return l < r ? -1 : l > r ? 1 : 0;
+}
+
+// Make room by evicting the least used entries, as pg_stat_statements
+// does. Exclusive lock must be held.
+static void entry_dealloc()
+{
+    HASH_SEQ_STATUS status;
+    StatsHashEntry *entry;
+    long count = hash_get_num_entries(hash);
+    long i = 0;
+
+    auto **entries = static_cast<StatsHashEntry **>(
+        palloc(count * sizeof(StatsHashEntry *)));
+
+    hash_seq_init(&status, hash);
+    while ((entry = static_cast<StatsHashEntry *>(hash_seq_search(&status)))) {
+        entries[i++] = entry;
+        entry->usage *= USAGE_DECREASE_FACTOR;
+    }
+
+    qsort(entries, i, sizeof(StatsHashEntry *), entry_cmp);
+
+    long evict = std::max(10L, i * USAGE_DEALLOC_PERCENT / 100);
+    for (long j = 0; j < std::min(evict, i); j++)
+        hash_search(hash, &entries[j]->key, HASH_REMOVE, nullptr);
+
+    pfree(entries);
+}
+
+void stats_record(Oid dbid, uint64 queryid, const PlanningCounters &counters,
+                  uint64 time, bool captured)
+{
+    StatsKey key;
+    memset(&key, 0, sizeof key); // Padding is hashed too
+    key.dbid = dbid;
+    key.queryid = queryid;
+
+    LWLockAcquire(shared->lock, LW_SHARED);
+
+    auto *entry = static_cast<StatsHashEntry *>(
+        hash_search(hash, &key, HASH_FIND, nullptr));
+
+    if (!entry) {
+        // Upgrade, someone could have added it meanwhile.
+        LWLockRelease(shared->lock);
+        LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+
+        entry = static_cast<StatsHashEntry *>(
+            hash_search(hash, &key, HASH_FIND, nullptr));
+
+        if (!entry) {
+            while (hash_get_num_entries(hash) >= max_entries)
+                entry_dealloc();
+
+            entry = static_cast<StatsHashEntry *>(
+                hash_search(hash, &key, HASH_ENTER, nullptr));
+
+            memset(reinterpret_cast<char *>(entry) + sizeof(StatsKey), 0,
+                   sizeof *entry - sizeof(StatsKey));
+            SpinLockInit(&entry->mutex);
+        }
+    }
+
+    const double ms = time / 1e6;
+
+    SpinLockAcquire(&entry->mutex);
+    entry->usage += USAGE_PLAN;
+    entry->plans++;
+    entry->total_time += ms;
+    if (ms > entry->max_time)
+        entry->max_time = ms;
+    entry->paths += counters.paths;
+    entry->join_rels += counters.join_rels;
+    if (captured) {
+        entry->captures++;
+        entry->capture_time += counters.capture_time / 1e6;
+    }
+    SpinLockRelease(&entry->mutex);
+
+    LWLockRelease(shared->lock);
+}
+
+void stats_record_capture(Oid dbid, uint64 queryid, uint64 time)
+{
+    StatsKey key;
+    memset(&key, 0, sizeof key);
+    key.dbid = dbid;
+    key.queryid = queryid;
+
+    LWLockAcquire(shared->lock, LW_SHARED);
+
+    auto *entry = static_cast<StatsHashEntry *>(
+        hash_search(hash, &key, HASH_FIND, nullptr));
+
+    if (entry) {
+        SpinLockAcquire(&entry->mutex);
+        entry->capture_time += time / 1e6;
+        SpinLockRelease(&entry->mutex);
+    }
+
+    LWLockRelease(shared->lock);
+}
+
+std::vector<StatsEntry> stats_snapshot()
+{
+    std::vector<StatsEntry> entries;
+    HASH_SEQ_STATUS status;
+    StatsHashEntry *entry;
+
+    // Allocate up front, bad_alloc must not escape with the lock held.
+    // stats_record() keeps the hash at max_entries at most.
+    entries.reserve(max_entries);
+
+    LWLockAcquire(shared->lock, LW_SHARED);
+
+    hash_seq_init(&status, hash);
+    while ((entry = static_cast<StatsHashEntry *>(hash_seq_search(&status)))) {
+        StatsEntry e;
+
+        e.dbid = entry->key.dbid;
+        e.queryid = entry->key.queryid;
+
+        SpinLockAcquire(&entry->mutex);
+        e.plans = entry->plans;
+        e.total_time = entry->total_time;
+        e.max_time = entry->max_time;
+        e.paths = entry->paths;
+        e.join_rels = entry->join_rels;
+        e.captures = entry->captures;
+        e.capture_time = entry->capture_time;
+        SpinLockRelease(&entry->mutex);
+
+        entries.push_back(e);
+    }
+
+    LWLockRelease(shared->lock);
+
+    return entries;
+}
+
+void stats_reset()
+{
+    HASH_SEQ_STATUS status;
+    StatsHashEntry *entry;
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+
+    hash_seq_init(&status, hash);
+    while ((entry = static_cast<StatsHashEntry *>(hash_seq_search(&status))))
+        hash_search(hash, &entry->key, HASH_REMOVE, nullptr);
+
+    LWLockRelease(shared->lock);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+extern "C" {
+#include "postgres.h"
+}
+
+#include <vector>
+
+// Cluster-wide planning statistics by statement, kept in shared memory
+// akin to pg_stat_statements. Available when planscape is preloaded.
+
+// Counted by hooks while a statement is planned.
+struct PlanningCounters
+{
+    uint64      paths = 0;
+    uint64      join_rels = 0;
+    uint64      capture_time = 0; // ns spent in capture code
+};
+
+// Request shared memory, call from _PG_init() while preloading.
+void stats_request(int max_entries);
+
+// Attach to shared memory, shmem_startup_hook.
+void stats_startup();
+
+// Shared memory is there.
+bool stats_available();
+
+// Fold a planner invocation into the statement's entry. @captured if a
+// PLANSCAPE capture was active. Planning time is in ns.
+void stats_record(Oid dbid, uint64 queryid, const PlanningCounters &counters,
+                  uint64 time, bool captured);
+
+// Add @time (ns) spent reporting a capture to the statement's entry,
+// if there is one.
+void stats_record_capture(Oid dbid, uint64 queryid, uint64 time);
+
+struct StatsEntry
+{
+    Oid         dbid;
+    uint64      queryid;
+    int64       plans;
+    double      total_time; // ms
+    double      max_time; // ms
+    int64       paths;
+    int64       join_rels;
+    int64       captures; // Plans made while capturing
+    double      capture_time; // ms, spent capturing and reporting
+};
+
+// Copy of all entries.
+std::vector<StatsEntry> stats_snapshot();
+
+void stats_reset();
@@ -0,0 +1,457 @@
+// Relocation tests for hook_engine.c: recorded function prologues are
+// placed in executable memory and hooked, the trampoline code and the
+// detour written over the prologue are checked byte by byte.
+//
+//   make check-hook-engine
+
+#include "hook_engine.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Must match hook_engine.c.
+#define HOOK_SLOT_LEN         128
+
+// A 4 byte field of the expected code that depends on addresses.
+struct Fixup
+{
+    int     at;     // Offset of the field in the expected code
+    int     next;   // Offset the displacement is relative to
+    int     table;  // Field points to a jump table entry
+    int32_t target; // Offset from the prologue, what the field (or the
+                    // jump table entry) has to reach
+};
+
+struct Case
+{
+    const char    *name;
+    uint8_t        prologue[16];
+    size_t         prologue_len;
+    uint8_t        expected[48]; // Trampoline code, fixup fields zeroed
+    size_t         expected_len;
+    struct Fixup   fixups[4];
+    size_t         clobbered;    // Prologue bytes replaced by the detour
+};
+
+#define BYTES(...)  {__VA_ARGS__}, sizeof((uint8_t[]){__VA_ARGS__})
+
+// jmp *table(%rip) is 6 bytes, the field is at +2.
+#define JMP_TABLE   0xFF, 0x25, 0, 0, 0, 0
+#define CALL_TABLE  0xFF, 0x15, 0, 0, 0, 0
+
+static const struct Case cases[] = {
+    {
+        // push %rbp; mov %rsp,%rbp; push %r15: copied verbatim, the
+        // detour clobbers a part of the last instruction.
+        "plain prologue",
+        BYTES(0x55, 0x48, 0x89, 0xE5, 0x41, 0x57),
+        BYTES(0x55, 0x48, 0x89, 0xE5, 0x41, 0x57, JMP_TABLE),
+        {{8, 12, 1, 6}},
+        6,
+    },
+    {
+        // mov 0x100(%rip),%rax
+        "rip-relative mov",
+        BYTES(0x48, 0x8B, 0x05, 0x00, 0x01, 0x00, 0x00),
+        BYTES(0x48, 0x8B, 0x05, 0, 0, 0, 0, JMP_TABLE),
+        {{3, 7, 0, 7 + 0x100}, {9, 13, 1, 7}},
+        7,
+    },
+    {
+        // lea -0x2000(%rip),%rdi
+        "rip-relative lea",
+        BYTES(0x48, 0x8D, 0x3D, 0x00, 0xE0, 0xFF, 0xFF),
+        BYTES(0x48, 0x8D, 0x3D, 0, 0, 0, 0, JMP_TABLE),
+        {{3, 7, 0, 7 - 0x2000}, {9, 13, 1, 7}},
+        7,
+    },
+    {
+        // cmpl $0x5,0x200(%rip): the displacement precedes an immediate
+        "rip-relative cmp with imm8",
+        BYTES(0x83, 0x3D, 0x00, 0x02, 0x00, 0x00, 0x05),
+        BYTES(0x83, 0x3D, 0, 0, 0, 0, 0x05, JMP_TABLE),
+        {{2, 7, 0, 7 + 0x200}, {9, 13, 1, 7}},
+        7,
+    },
+    {
+        // movl $0x1,0x300(%rip): ... or an imm32
+        "rip-relative mov with imm32",
+        BYTES(0xC7, 0x05, 0x00, 0x03, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00),
+        BYTES(0xC7, 0x05, 0, 0, 0, 0, 0x01, 0x00, 0x00, 0x00, JMP_TABLE),
+        {{2, 10, 0, 10 + 0x300}, {12, 16, 1, 10}},
+        10,
+    },
+    {
+        // jmp +0x40 (E9)
+        "jmp rel32",
+        BYTES(0xE9, 0x40, 0x00, 0x00, 0x00),
+        BYTES(JMP_TABLE, JMP_TABLE),
+        {{2, 6, 1, 5 + 0x40}, {8, 12, 1, 5}},
+        5,
+    },
+    {
+        // jmp +0x10 (EB); nop; nop; nop
+        "jmp rel8",
+        BYTES(0xEB, 0x10, 0x90, 0x90, 0x90),
+        BYTES(JMP_TABLE, 0x90, 0x90, 0x90, JMP_TABLE),
+        {{2, 6, 1, 2 + 0x10}, {11, 15, 1, 5}},
+        5,
+    },
+    {
+        // je +0x20; mov %rsp,%rbp: inverted to jne over a jump
+        "jcc rel8",
+        BYTES(0x74, 0x20, 0x48, 0x89, 0xE5),
+        BYTES(0x75, 0x06, JMP_TABLE, 0x48, 0x89, 0xE5, JMP_TABLE),
+        {{4, 8, 1, 2 + 0x20}, {13, 17, 1, 5}},
+        5,
+    },
+    {
+        // jne +0x80 (0F 85): converted to the short form
+        "jcc rel32",
+        BYTES(0x0F, 0x85, 0x80, 0x00, 0x00, 0x00),
+        BYTES(0x74, 0x06, JMP_TABLE, JMP_TABLE),
+        {{4, 8, 1, 6 + 0x80}, {10, 14, 1, 6}},
+        6,
+    },
+    {
+        // call +0x100
+        "call rel32",
+        BYTES(0xE8, 0x00, 0x01, 0x00, 0x00),
+        BYTES(CALL_TABLE, JMP_TABLE),
+        {{2, 6, 1, 5 + 0x100}, {8, 12, 1, 5}},
+        5,
+    },
+};
+
+// Prologues hooking must refuse.
+static const struct
+{
+    const char *name;
+    uint8_t     prologue[16];
+    size_t      prologue_len;
+    const char *error;
+} bad_cases[] = {
+    {
+        "breakpoint",
+        BYTES(0xCC, 0x48, 0x89, 0xE5, 0x90),
+        "'INT 3' instruction",
+    },
+    {
+        // jmp +1 lands in the clobbered range
+        "jump into clobbered range",
+        BYTES(0xEB, 0x01, 0x90, 0x90, 0x90),
+        "a jump into the clobbered instruction range",
+    },
+    {
+        "jrcxz",
+        BYTES(0xE3, 0x10, 0x90, 0x90, 0x90),
+        "'JCXZ' instruction not supported",
+    },
+};
+
+static int failures;
+
+static void fail(const char *name, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static
+void fail(const char *name, const char *fmt, ...)
+{
+    va_list args;
+
+    printf("FAIL %s: ", name);
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+
+    failures++;
+}
+
+static
+int32_t get_int32(const uint8_t *p)
+{
+    int32_t v;
+
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static
+uint64_t get_uint64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+// Hooked functions are never called, only their address matters.
+static
+void replacement(void)
+{
+}
+
+// Prologue in executable memory near replacement(), padded with int3.
+static
+uint8_t *place_prologue(const uint8_t *prologue, size_t len)
+{
+    uint8_t code[HOOK_CODE_MAX];
+
+    memset(code, 0xCC, sizeof code);
+    memcpy(code, prologue, len);
+    return hook_alloc_code((void *)replacement, code, sizeof code);
+}
+
+// The detour: jmp rel32 to @target, int3 over the rest of the
+// clobbered bytes, then the prologue intact.
+static
+int check_detour(const char *name, const uint8_t *fn, uintptr_t target,
+                 const uint8_t *prologue, size_t len, size_t clobbered)
+{
+    if (fn[0] != 0xE9
+        || (uintptr_t)fn + 5 + get_int32(fn + 1) != target) {
+        fail(name, "detour doesn't jump to %#lx", (unsigned long)target);
+        return -1;
+    }
+
+    for (size_t i = 5; i < clobbered; i++) {
+        if (fn[i] != 0xCC) {
+            fail(name, "byte %zu of the detour isn't int3", i);
+            return -1;
+        }
+    }
+
+    if (memcmp(fn + clobbered, prologue + clobbered, len - clobbered) != 0) {
+        fail(name, "bytes past the detour changed");
+        return -1;
+    }
+
+    return 0;
+}
+
+static
+int check_trampoline(const struct Case *c, const uint8_t *fn,
+                     const uint8_t *trampoline)
+{
+    uint8_t code[sizeof c->expected];
+
+    memcpy(code, trampoline, c->expected_len);
+
+    for (const struct Fixup *f = c->fixups; f->next; f++) {
+
+        const uintptr_t target = (uintptr_t)fn + f->target;
+        const uintptr_t next = (uintptr_t)trampoline + f->next;
+        const int32_t disp = get_int32(code + f->at);
+
+        if (f->table) {
+            const uint64_t entry = get_uint64((const uint8_t *)next + disp);
+
+            if (entry != target) {
+                fail(c->name, "jump table entry at +%d reaches %+ld, "
+                     "expected %+d", f->at,
+                     (long)(entry - (uintptr_t)fn), f->target);
+                return -1;
+            }
+        } else if (next + disp != target) {
+            fail(c->name, "displacement at +%d reaches %+ld, expected %+d",
+                 f->at, (long)(next + disp - (uintptr_t)fn), f->target);
+            return -1;
+        }
+
+        memset(code + f->at, 0, 4);
+    }
+
+    for (size_t i = 0; i < c->expected_len; i++) {
+        if (code[i] != c->expected[i]) {
+            fail(c->name, "trampoline byte %zu is %02x, expected %02x",
+                 i, code[i], c->expected[i]);
+            return -1;
+        }
+    }
+
+    if (trampoline[c->expected_len] != 0xCC) {
+        fail(c->name, "trampoline code longer than expected");
+        return -1;
+    }
+
+    return 0;
+}
+
+static
+void test_case(const struct Case *c)
+{
+    uint8_t *fn = place_prologue(c->prologue, c->prologue_len);
+    void *trampoline;
+
+    if (!fn) {
+        fail(c->name, "%s", hook_last_error());
+        return;
+    }
+
+    if (hook_install_alloc(fn, (void *)replacement, &trampoline) != 0) {
+        fail(c->name, "%s", hook_last_error());
+        return;
+    }
+
+    const int rc = check_detour(c->name, fn, (uintptr_t)replacement,
+                                c->prologue, c->prologue_len, c->clobbered)
+                   || check_trampoline(c, fn, trampoline);
+
+    if (hook_uninstall(fn) != 0)
+        fail(c->name, "%s", hook_last_error());
+    else if (memcmp(fn, c->prologue, c->prologue_len) != 0)
+        fail(c->name, "prologue not restored");
+    else if (rc == 0)
+        printf("ok   %s\n", c->name);
+
+    hook_free_code(fn);
+}
+
+static
+void test_bad_case(const char *name, const uint8_t *prologue, size_t len,
+                   const char *error)
+{
+    uint8_t *fn = place_prologue(prologue, len);
+    void *trampoline;
+
+    if (!fn) {
+        fail(name, "%s", hook_last_error());
+        return;
+    }
+
+    if (hook_install_alloc(fn, (void *)replacement, &trampoline) == 0)
+        fail(name, "hooked");
+    else if (!strstr(hook_last_error(), error))
+        fail(name, "unexpected error: %s", hook_last_error());
+    else if (memcmp(fn, prologue, len) != 0)
+        fail(name, "prologue changed");
+    else
+        printf("ok   %s\n", name);
+
+    hook_free_code(fn);
+}
+
+// A replacement out of rel32 reach gets a relay slot near the function:
+// jmp *0(%rip) followed by the address.
+static
+void test_relay(void)
+{
+    static const uint8_t prologue[] = {0x55, 0x48, 0x89, 0xE5, 0x41, 0x57};
+    const char *name = "relay to a far replacement";
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    uint8_t *fn = place_prologue(prologue, sizeof prologue);
+    void *trampoline;
+
+    // Never called.
+    void *far = mmap((void *)(((uintptr_t)fn & ~(page_size - 1))
+                              + ((uintptr_t)64 << 30)),
+                     page_size, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    if (!fn || far == MAP_FAILED) {
+        fail(name, "no memory");
+        return;
+    }
+
+    if (hook_install_alloc(fn, far, &trampoline) != 0) {
+        fail(name, "%s", hook_last_error());
+        return;
+    }
+
+    const uint8_t *relay = fn + 5 + get_int32(fn + 1);
+
+    int rc = -1;
+
+    if (fn[0] != 0xE9)
+        fail(name, "no rel32 jump to a relay");
+    else if (relay[0] != 0xFF || relay[1] != 0x25 || get_int32(relay + 2) != 0
+             || get_uint64(relay + 6) != (uintptr_t)far)
+        fail(name, "relay doesn't jump to the replacement");
+    else
+        rc = check_detour(name, fn, (uintptr_t)relay, prologue,
+                          sizeof prologue, 6);
+
+    if (hook_uninstall(fn) != 0)
+        fail(name, "%s", hook_last_error());
+    else if (rc == 0 && relay[0] != 0xCC)
+        fail(name, "relay slot not reset");
+    else if (rc == 0)
+        printf("ok   %s\n", name);
+
+    hook_free_code(fn);
+    munmap(far, page_size);
+}
+
+// Nothing to put a relay in: movabs $replacement,%rax; jmp *%rax.
+static
+void test_absolute(void)
+{
+    static const uint8_t prologue[] = {
+        0x55, 0x48, 0x89, 0xE5, 0x41, 0x57, 0x41, 0x56, 0x41, 0x55,
+        0x41, 0x54, 0x53,
+    };
+    const char *name = "absolute jump with the pool exhausted";
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    uint8_t *fn = place_prologue(prologue, sizeof prologue);
+
+    void *far = mmap((void *)(((uintptr_t)fn & ~(page_size - 1))
+                              + ((uintptr_t)64 << 30)),
+                     page_size, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    if (!fn || far == MAP_FAILED) {
+        fail(name, "no memory");
+        return;
+    }
+
+    // Exhaust the pool, the slots are deliberately leaked.
+    while (hook_alloc_code((void *)replacement, prologue, sizeof prologue))
+        ;
+
+    if (hook_install(fn, far, NULL) != 0) {
+        fail(name, "%s", hook_last_error());
+        return;
+    }
+
+    static const uint8_t movabs[] = {0x48, 0xB8};
+    static const uint8_t jmp_rax[] = {0xFF, 0xE0};
+
+    if (memcmp(fn, movabs, 2) != 0 || get_uint64(fn + 2) != (uintptr_t)far
+        || memcmp(fn + 10, jmp_rax, 2) != 0)
+        fail(name, "no movabs/jmp %%rax detour");
+    else if (fn[12] != 0x53)
+        fail(name, "bytes past the detour changed");
+    else if (hook_uninstall(fn) != 0)
+        fail(name, "%s", hook_last_error());
+    else if (memcmp(fn, prologue, sizeof prologue) != 0)
+        fail(name, "prologue not restored");
+    else
+        printf("ok   %s\n", name);
+
+    munmap(far, page_size);
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++)
+        test_case(&cases[i]);
+
+    for (size_t i = 0; i < sizeof bad_cases / sizeof bad_cases[0]; i++)
+        test_bad_case(bad_cases[i].name, bad_cases[i].prologue,
+                      bad_cases[i].prologue_len, bad_cases[i].error);
+
+    test_relay();
+
+    // Last, leaves the pool exhausted.
+    test_absolute();
+
+    if (failures) {
+        printf("%d test(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
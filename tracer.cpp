@@ -0,0 +1,491 @@
+#include "tracer.h"
+#include "hook_engine.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <link.h>
+#include <elf.h>
+#include <dlfcn.h>
+#include <sys/auxv.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <set>
+
+namespace {
+
+// Layout known to the entry thunk: @original must come first.
+struct TraceRecord
+{
+    void       *original; // trampoline, calls the original code
+    void       *fn;
+    const char *name;
+    uint64_t    calls;
+    uint64_t    time;
+    uint64_t    histogram[TRACE_HISTOGRAM_BUCKETS];
+    void       *stub;
+};
+
+// A call in progress, the return address it was entered with and the
+// stack slot it was found in.
+struct TraceFrame
+{
+    TraceRecord *record;
+    uint64_t     ret;
+    uint64_t    *slot;
+    uint64_t     start;
+};
+
+// Calls deeper than this are counted but not timed.
+constexpr int    STACK_MAX = 1024;
+
+// Per-function stub: movabs $record, %r11; jmp *0(%rip); .quad thunk
+constexpr size_t STUB_LEN  = 32;
+
+}
+
+extern "C" {
+void planscape_trace_entry_thunk();
+void planscape_trace_exit_thunk();
+void planscape_trace_enter(TraceRecord *record, uint64_t *ret_slot);
+uint64_t planscape_trace_exit(uint64_t *rsp);
+}
+
+static std::vector<TraceRecord *> g_records; // never freed
+static TraceFrame                 g_stack[STACK_MAX];
+static int                        g_depth;
+static bool                       g_in_tracer;
+static void                     (*g_error_handler)(const char *message);
+
+// Entered from a function stub with the record in %r11 and the
+// function's arguments intact. Everything the callee may receive
+// arguments in is saved: integer registers, %rax (vector register
+// count for varargs), %r10 (static chain) and %xmm0-7. The return
+// address is at 200(%rsp) once all of it has been pushed.
+__asm__(".text\n"
+        ".globl planscape_trace_entry_thunk\n"
+        ".hidden planscape_trace_entry_thunk\n"
+        ".type planscape_trace_entry_thunk, @function\n"
+        "planscape_trace_entry_thunk:\n"
+        "\tpushq %rdi\n"
+        "\tpushq %rsi\n"
+        "\tpushq %rdx\n"
+        "\tpushq %rcx\n"
+        "\tpushq %r8\n"
+        "\tpushq %r9\n"
+        "\tpushq %rax\n"
+        "\tpushq %r10\n"
+        "\tpushq %r11\n"
+        "\tsubq $128, %rsp\n"
+        "\tmovdqu %xmm0, 0(%rsp)\n"
+        "\tmovdqu %xmm1, 16(%rsp)\n"
+        "\tmovdqu %xmm2, 32(%rsp)\n"
+        "\tmovdqu %xmm3, 48(%rsp)\n"
+        "\tmovdqu %xmm4, 64(%rsp)\n"
+        "\tmovdqu %xmm5, 80(%rsp)\n"
+        "\tmovdqu %xmm6, 96(%rsp)\n"
+        "\tmovdqu %xmm7, 112(%rsp)\n"
+        "\tmovq %r11, %rdi\n"
+        "\tleaq 200(%rsp), %rsi\n"
+        "\tcall planscape_trace_enter\n"
+        "\tmovdqu 0(%rsp), %xmm0\n"
+        "\tmovdqu 16(%rsp), %xmm1\n"
+        "\tmovdqu 32(%rsp), %xmm2\n"
+        "\tmovdqu 48(%rsp), %xmm3\n"
+        "\tmovdqu 64(%rsp), %xmm4\n"
+        "\tmovdqu 80(%rsp), %xmm5\n"
+        "\tmovdqu 96(%rsp), %xmm6\n"
+        "\tmovdqu 112(%rsp), %xmm7\n"
+        "\taddq $128, %rsp\n"
+        "\tpopq %r11\n"
+        "\tpopq %r10\n"
+        "\tpopq %rax\n"
+        "\tpopq %r9\n"
+        "\tpopq %r8\n"
+        "\tpopq %rcx\n"
+        "\tpopq %rdx\n"
+        "\tpopq %rsi\n"
+        "\tpopq %rdi\n"
+        "\tjmpq *(%r11)\n"
+        ".size planscape_trace_entry_thunk, .-planscape_trace_entry_thunk\n");
+
+// Returned into instead of the traced function's caller. Preserves
+// the return value (%rax:%rdx, %xmm0:%xmm1) and continues at the
+// original return address.
+//
+// The original return address is in g_stack only, out of the
+// unwinder's reach: the CFI marks it undefined, so that unwinding
+// stops here cleanly (tracer_resolve_backtrace() puts the caller back).
+// The nop covers the unwinder's lookup of the return address minus one.
+__asm__(".text\n"
+        ".globl planscape_trace_exit_thunk\n"
+        ".hidden planscape_trace_exit_thunk\n"
+        ".type planscape_trace_exit_thunk, @function\n"
+        ".cfi_startproc\n"
+        "\t.cfi_undefined rip\n"
+        "\tnop\n"
+        "planscape_trace_exit_thunk:\n"
+        "\t.cfi_def_cfa_offset 0\n"
+        "\tpushq %rax\n"
+        "\t.cfi_adjust_cfa_offset 8\n"
+        "\tpushq %rdx\n"
+        "\t.cfi_adjust_cfa_offset 8\n"
+        "\tsubq $32, %rsp\n"
+        "\t.cfi_adjust_cfa_offset 32\n"
+        "\tmovdqu %xmm0, 0(%rsp)\n"
+        "\tmovdqu %xmm1, 16(%rsp)\n"
+        "\tleaq 48(%rsp), %rdi\n"
+        "\tcall planscape_trace_exit\n"
+        "\tmovq %rax, %r11\n"
+        "\tmovdqu 0(%rsp), %xmm0\n"
+        "\tmovdqu 16(%rsp), %xmm1\n"
+        "\taddq $32, %rsp\n"
+        "\t.cfi_adjust_cfa_offset -32\n"
+        "\tpopq %rdx\n"
+        "\t.cfi_adjust_cfa_offset -8\n"
+        "\tpopq %rax\n"
+        "\t.cfi_adjust_cfa_offset -8\n"
+        "\tjmpq *%r11\n"
+        "\t.cfi_endproc\n"
+        ".size planscape_trace_exit_thunk, .-planscape_trace_exit_thunk\n");
+
+typedef int (*ClockGettime)(clockid_t, struct timespec *);
+
+// The vDSO's clock_gettime(): neither dlsym() nor the executable's
+// symbol table know it, so it can't be traced.
+static ClockGettime vdso_clock_gettime()
+{
+    const auto *base = reinterpret_cast<const uint8_t *>(getauxval(AT_SYSINFO_EHDR));
+    if (!base)
+        return nullptr;
+
+    const auto *ehdr = reinterpret_cast<const Elf64_Ehdr *>(base);
+    const auto *phdrs = reinterpret_cast<const Elf64_Phdr *>(base + ehdr->e_phoff);
+    const auto *shdrs = reinterpret_cast<const Elf64_Shdr *>(base + ehdr->e_shoff);
+    uintptr_t bias = 0;
+
+    for (int i = 0; i < ehdr->e_phnum; i++) {
+        if (phdrs[i].p_type == PT_LOAD) {
+            bias = (uintptr_t)base + phdrs[i].p_offset - phdrs[i].p_vaddr;
+            break;
+        }
+    }
+
+    for (int i = 0; i < ehdr->e_shnum; i++) {
+        if (shdrs[i].sh_type != SHT_DYNSYM || shdrs[i].sh_link >= ehdr->e_shnum)
+            continue;
+
+        const auto *syms = reinterpret_cast<const Elf64_Sym *>(base + shdrs[i].sh_offset);
+        const char *strtab = reinterpret_cast<const char *>(
+                base + shdrs[shdrs[i].sh_link].sh_offset);
+
+        for (size_t j = 0; j < shdrs[i].sh_size / sizeof(Elf64_Sym); j++) {
+            if (syms[j].st_shndx != SHN_UNDEF
+                && strcmp(strtab + syms[j].st_name, "__vdso_clock_gettime") == 0)
+                return reinterpret_cast<ClockGettime>(bias + syms[j].st_value);
+        }
+    }
+
+    return nullptr;
+}
+
+static const ClockGettime g_clock_gettime = vdso_clock_gettime();
+
+// Callers set g_in_tracer: should the vDSO be missing, clock_gettime()
+// may be traced.
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    if (g_clock_gettime)
+        g_clock_gettime(CLOCK_MONOTONIC, &ts);
+    else
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void planscape_trace_enter(TraceRecord *record, uint64_t *ret_slot)
+{
+    // Tracer calling into a traced function (clock_gettime?)
+    if (g_in_tracer) return;
+    g_in_tracer = true;
+
+    record->calls++;
+
+    // Tail call from another traced function: the frame is already
+    // accounted for, time goes to the caller.
+    if (*ret_slot == (uint64_t)planscape_trace_exit_thunk) {
+        g_in_tracer = false;
+        return;
+    }
+
+    // Frames at or below the new one were abandoned by longjmp().
+    while (g_depth && g_stack[g_depth - 1].slot <= ret_slot)
+        g_depth--;
+
+    if (g_depth < STACK_MAX) {
+        TraceFrame &frame = g_stack[g_depth++];
+        frame.record = record;
+        frame.ret    = *ret_slot;
+        frame.slot   = ret_slot;
+        frame.start  = now_ns();
+        *ret_slot = (uint64_t)planscape_trace_exit_thunk;
+    }
+
+    g_in_tracer = false;
+}
+
+uint64_t planscape_trace_exit(uint64_t *rsp)
+{
+    uint64_t * const slot = rsp - 1;
+
+    g_in_tracer = true;
+    const uint64_t   end  = now_ns();
+    g_in_tracer = false;
+
+    while (g_depth && g_stack[g_depth - 1].slot < slot)
+        g_depth--;
+
+    // Nowhere to return to.
+    if (!g_depth || g_stack[g_depth - 1].slot != slot) {
+        if (g_error_handler)
+            g_error_handler("returned to a frame not on the tracer's stack");
+        abort();
+    }
+
+    const TraceFrame &frame   = g_stack[--g_depth];
+    const uint64_t    elapsed = end - frame.start;
+    const int         bucket  = 63 - __builtin_clzll(elapsed | 1);
+
+    frame.record->time += elapsed;
+    frame.record->histogram[bucket < TRACE_HISTOGRAM_BUCKETS
+                            ? bucket : TRACE_HISTOGRAM_BUCKETS - 1]++;
+
+    return frame.ret;
+}
+
+// Allocated next to the function, written through the hook engine: no
+// page is ever writable and executable.
+static void *make_stub(TraceRecord *record)
+{
+    uint8_t stub[STUB_LEN];
+    const uint64_t record_addr = (uint64_t)record;
+    const uint64_t thunk_addr  = (uint64_t)planscape_trace_entry_thunk;
+
+    // movabs $record, %r11
+    stub[0] = 0x49;
+    stub[1] = 0xBB;
+    memcpy(stub + 2, &record_addr, 8);
+
+    // jmp *0(%rip)
+    stub[10] = 0xFF;
+    stub[11] = 0x25;
+    memset(stub + 12, 0, 4);
+    memcpy(stub + 16, &thunk_addr, 8);
+
+    memset(stub + 24, 0xcc, STUB_LEN - 24);
+
+    return hook_alloc_code(record->fn, stub, STUB_LEN);
+}
+
+static int first_object_bias(struct dl_phdr_info *info, size_t, void *data)
+{
+    *static_cast<uintptr_t *>(data) = info->dlpi_addr;
+    return 1;
+}
+
+// Look @name up in the executable's .symtab, if it wasn't stripped.
+static void *resolve_symtab(const char *name, std::string *error)
+{
+    int fd = open("/proc/self/exe", O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        *error = std::string("reading executable: ") + strerror(errno);
+        if (fd != -1) close(fd);
+        return nullptr;
+    }
+
+    void *image = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (image == MAP_FAILED) {
+        *error = std::string("mapping executable: ") + strerror(errno);
+        return nullptr;
+    }
+
+    const auto *base = static_cast<const uint8_t *>(image);
+    const auto *ehdr = static_cast<const Elf64_Ehdr *>(image);
+    std::set<uint64_t> matches;
+    bool has_symtab = false;
+
+    if ((size_t)st.st_size >= sizeof *ehdr
+        && memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0
+        && ehdr->e_ident[EI_CLASS] == ELFCLASS64
+        && ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr) <= (size_t)st.st_size) {
+
+        const auto *shdrs = reinterpret_cast<const Elf64_Shdr *>(base + ehdr->e_shoff);
+
+        for (int i = 0; i < ehdr->e_shnum; i++) {
+            if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= ehdr->e_shnum)
+                continue;
+
+            has_symtab = true;
+
+            const auto *syms = reinterpret_cast<const Elf64_Sym *>(base + shdrs[i].sh_offset);
+            const char *strtab = reinterpret_cast<const char *>(base + shdrs[shdrs[i].sh_link].sh_offset);
+            const size_t count = shdrs[i].sh_size / sizeof(Elf64_Sym);
+
+            for (size_t j = 0; j < count; j++) {
+                if (ELF64_ST_TYPE(syms[j].st_info) == STT_FUNC
+                    && syms[j].st_shndx != SHN_UNDEF
+                    && strcmp(strtab + syms[j].st_name, name) == 0)
+                    matches.insert(syms[j].st_value);
+            }
+        }
+    }
+
+    munmap(image, st.st_size);
+
+    if (matches.size() == 1) {
+        uintptr_t bias = 0;
+        dl_iterate_phdr(first_object_bias, &bias);
+        return (void *)(bias + *matches.begin());
+    }
+
+    if (matches.size() > 1)
+        *error = "ambiguous: several static functions share the name";
+    else if (!has_symtab)
+        *error = "not exported and the executable has no symbol table";
+    else
+        *error = "no such function";
+
+    return nullptr;
+}
+
+static TraceRecord *find_record(const char *name)
+{
+    for (TraceRecord *record : g_records) {
+        if (strcmp(record->name, name) == 0)
+            return record;
+    }
+    return nullptr;
+}
+
+bool tracer_trace(const char *name, std::string *error)
+{
+    TraceRecord *record = find_record(name);
+
+    if (record && record->original)
+        return true;
+
+    void *fn = record ? record->fn : dlsym(RTLD_DEFAULT, name);
+
+    if (!fn && !(fn = resolve_symtab(name, error)))
+        return false;
+
+    if (!record) {
+        record = new TraceRecord();
+        record->fn   = fn;
+        record->name = strdup(name);
+        g_records.push_back(record);
+    }
+
+    if (hook_begin() != 0) {
+        *error = hook_last_error();
+        return false;
+    }
+
+    void *stub = make_stub(record);
+    int rc = stub ? hook_install_alloc(fn, stub, &record->original) : -1;
+
+    if (rc != 0)
+        hook_abort();
+    else
+        rc = hook_end();
+
+    if (rc != 0) {
+        record->original = nullptr;
+        *error = hook_last_error();
+        return false;
+    }
+
+    record->stub = stub;
+    return true;
+}
+
+bool tracer_untrace(const char *name, std::string *error)
+{
+    TraceRecord *record = find_record(name);
+
+    if (!record || !record->original) {
+        *error = "not traced";
+        return false;
+    }
+
+    if (hook_begin() != 0) {
+        *error = hook_last_error();
+        return false;
+    }
+
+    // Calls in progress are past the stub already.
+    int rc = hook_uninstall(record->fn);
+
+    if (rc == 0)
+        rc = hook_free_code(record->stub);
+
+    if (rc != 0)
+        hook_abort();
+    else
+        rc = hook_end();
+
+    if (rc != 0) {
+        *error = hook_last_error();
+        return false;
+    }
+
+    // Calls in progress return through the exit thunk still.
+    record->original = nullptr;
+    record->stub = nullptr;
+    return true;
+}
+
+void tracer_set_error_handler(void (*handler)(const char *message))
+{
+    g_error_handler = handler;
+}
+
+void tracer_resolve_backtrace(void **frames, int depth)
+{
+    const auto *sp = static_cast<uint64_t *>(__builtin_frame_address(0));
+    int top = g_depth;
+
+    // Frames below our own were abandoned by longjmp().
+    while (top && g_stack[top - 1].slot < sp)
+        top--;
+
+    for (int i = 0; i < depth; i++) {
+        if (frames[i] == (void *)planscape_trace_exit_thunk)
+            frames[i] = top ? (void *)g_stack[--top].ret : nullptr;
+    }
+}
+
+std::vector<TraceStats> tracer_stats()
+{
+    std::vector<TraceStats> stats;
+
+    for (const TraceRecord *record : g_records) {
+        TraceStats s;
+        s.name   = record->name;
+        s.traced = record->original != nullptr;
+        s.calls  = record->calls;
+        s.time   = record->time;
+        memcpy(s.histogram, record->histogram, sizeof s.histogram);
+        stats.push_back(s);
+    }
+
+    return stats;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Runtime function tracer. A traced function is hooked with an entry
+// thunk that preserves argument registers, notes the time and swaps the
+// return address for an exit thunk; the exit thunk charges inclusive
+// time to the function. Everything is backend-local.
+
+// Latency histogram buckets: bucket i counts calls that took
+// [2^i, 2^(i+1)) ns, the last bucket is open-ended.
+constexpr int TRACE_HISTOGRAM_BUCKETS = 32;
+
+struct TraceStats
+{
+    std::string name;
+    bool        traced;
+    uint64_t    calls;
+    uint64_t    time;       // ns, inclusive
+    uint64_t    histogram[TRACE_HISTOGRAM_BUCKETS];
+};
+
+// Start tracing function @name. Resolved with dlsym() first, then with
+// the executable's symbol table (static functions). Tracing a function
+// that is already traced is a no-op; statistics collected earlier are
+// kept.
+//
+// Returns: false on error, check @error
+bool tracer_trace(const char *name, std::string *error);
+
+// Stop tracing function @name. Statistics are retained.
+//
+// Returns: false on error, check @error
+bool tracer_untrace(const char *name, std::string *error);
+
+// Statistics of every function traced so far, in order of tracing.
+std::vector<TraceStats> tracer_stats();
+
+// Called when a traced function returns to a frame the tracer has no
+// record of; must not return, e.g. ereport(ERROR). The process aborts
+// if there is no handler.
+void tracer_set_error_handler(void (*handler)(const char *message));
+
+// Replace the exit thunk in a backtrace() of the current thread with
+// the return addresses it stands for. Unwinding stops at the thunk, so
+// only the innermost traced function's caller is usually recovered.
+// Async-signal-safe.
+void tracer_resolve_backtrace(void **frames, int depth);